@@ -92,6 +92,22 @@ typedef struct {
 	intptr_t value;
 } gcfg_enum_t;
 
+typedef enum {
+	/* The line is known to be valid UTF-8 and is not checked again */
+	GCFG_LINE_VALID_UTF8 = 0x01,
+} GCFG_LINE_FLAGS;
+
+typedef struct {
+	/* Mutable, null-terminated line without line break */
+	char *data;
+
+	/* Length of the line in bytes, excluding the null-terminator */
+	size_t length;
+
+	/* Combination of GCFG_LINE_FLAGS */
+	uint32_t flags;
+} gcfg_line_t;
+
 typedef struct gcfg_file_t {
 	void (*report_error)(struct gcfg_file_t *f, const char *msg, ...)
 		GCFG_PRINTF_FUN(2, 3);
@@ -106,11 +122,64 @@ typedef struct gcfg_file_t {
 
 	/* Mutable buffer holding the current line */
 	char *buffer;
+
+	/* Optional, can be NULL. Fetches a batch of lines at once and returns
+	   the same as fetch_line. On success, sets `lines` to an array of
+	   `line_count` lines, prepared the same way as by fetch_line and valid
+	   until the next call.
+
+	   While working through a batch, the parser points `buffer` to the
+	   current line and stores its index in `line_index`, so error
+	   messages can be attributed to the right line.
+	*/
+	int (*fetch_lines)(struct gcfg_file_t *f);
+
+	gcfg_line_t *lines;
+	size_t line_count;
+	size_t line_index;
 } gcfg_file_t;
 
+typedef struct gcfg_include_cache_t gcfg_include_cache_t;
+
+typedef enum {
+	/* The body of a block is not parsed along with the rest of the file.
+	   Only its braces are checked, the range of lines it spans is handed
+	   to handle_deferred instead, to be parsed later through
+	   gcfg_parse_deferred, if at all. Ignored for keywords with a
+	   listing, as well as by readers, documents and the push parser
+	   (gcfg_parser_create), which parse the body right away. */
+	GCFG_KEYWORD_DEFERRED = 0x01,
+
+	/* Consecutive values of the keyword in the same block are collected
+	   and handed to handle_batch all at once, when the next line that is
+	   not one of them is parsed or the input ends. set_property and
+	   finalize_object are not called for them, a line that opens a block
+	   is handled as usual. Ignored by readers and documents. If built
+	   without malloc, every value is a batch of its own. When parsing in
+	   parallel, values at the top level may be split into several
+	   batches. */
+	GCFG_KEYWORD_BATCH = 0x02,
+} GCFG_KEYWORD_FLAGS;
+
+struct gcfg_keyword_t;
+
+/* The body of a block opened by a keyword with GCFG_KEYWORD_DEFERRED */
+typedef struct {
+	const struct gcfg_keyword_t *keyword;
+
+	/* Number of the first line after the one opening the block, counted
+	   the same way as in error messages */
+	unsigned long line;
+
+	/* Number of lines, including the one with the closing '}' */
+	unsigned long count;
+} gcfg_deferred_t;
+
 typedef struct gcfg_keyword_t {
 	uint32_t arg;
-	uint32_t pad0;
+
+	/* Combination of GCFG_KEYWORD_FLAGS */
+	uint32_t flags;
 
 	const char *name;
 
@@ -127,8 +196,194 @@ typedef struct gcfg_keyword_t {
 
 	int (*handle_listing)(gcfg_file_t *file, void *child,
 			      const char *line);
+
+	/* Optional, receives the body of a deferred block after
+	   set_property and before finalize_object. If NULL, the body is
+	   skipped. */
+	int (*handle_deferred)(gcfg_file_t *file, void *child,
+			       const gcfg_deferred_t *body);
+
+	/* Receives the values of a keyword with GCFG_KEYWORD_BATCH. The
+	   values, including their strings, are only valid during the call. */
+	int (*handle_batch)(gcfg_file_t *file, void *parent,
+			    const gcfg_value_t *values, size_t count);
 } gcfg_keyword_t;
 
+struct gcfg_keyword_index_t;
+
+/* An open block on the parser stack */
+typedef struct {
+	/* Keyword that opened the block */
+	const gcfg_keyword_t *keyword;
+
+	/* Object returned for it by set_property */
+	void *object;
+
+	/* Lookup table for the keywords in the block, used by the parser */
+	const struct gcfg_keyword_index_t *index;
+} gcfg_block_t;
+
+/* Maximum nesting depth of blocks used by gcfg_parse_file */
+#define GCFG_DEFAULT_MAX_DEPTH (32)
+
+typedef enum {
+	/* A keyword followed by '{', the block is now open */
+	GCFG_EVENT_BEGIN_BLOCK = 1,
+
+	/* A keyword without a block */
+	GCFG_EVENT_VALUE,
+
+	/* A raw line inside a block of a keyword with handle_listing */
+	GCFG_EVENT_LISTING_LINE,
+
+	/* The '}' closing the innermost open block */
+	GCFG_EVENT_END_BLOCK,
+} GCFG_EVENT_TYPE;
+
+typedef struct {
+	/* A GCFG_EVENT_TYPE */
+	int type;
+
+	/* The keyword of the event, or of the enclosing block for
+	   listing lines and the end of a block */
+	const gcfg_keyword_t *keyword;
+
+	/* The keyword argument for BEGIN_BLOCK and VALUE events */
+	gcfg_value_t value;
+
+	/* The line for LISTING_LINE events and for the END_BLOCK event
+	   that closes a listing, NULL otherwise */
+	const char *line;
+
+	/* Number of the line the event was generated for, counting from 1
+	   at the point where reading started */
+	unsigned long linenum;
+} gcfg_event_t;
+
+typedef struct gcfg_reader_t gcfg_reader_t;
+
+typedef struct gcfg_parser_t gcfg_parser_t;
+
+typedef enum {
+	/* The top level of a document, always node 0 */
+	GCFG_NODE_ROOT = 0,
+
+	/* A keyword with its argument */
+	GCFG_NODE_KEYWORD = 1,
+
+	/* A line inside the block of a keyword with handle_listing */
+	GCFG_NODE_LISTING_LINE = 2,
+
+	/* A keyword followed by a block, which holds its children */
+	GCFG_NODE_BLOCK = 3,
+} GCFG_NODE_TYPE;
+
+/* A node of a parsed document. Nodes refer to each other and to their
+   strings through indices and offsets, never through pointers, so the
+   whole document can be copied or mapped to another address. */
+typedef struct {
+	/* A GCFG_NODE_TYPE */
+	uint32_t type;
+
+	/* Index of the keyword in the list it was taken from */
+	uint32_t keyword;
+
+	/* String offset of the keyword name, or of the line for listing
+	   lines */
+	uint32_t name;
+
+	/* Node indices of the first child and the next sibling, 0 if there
+	   is none */
+	uint32_t child;
+	uint32_t next;
+
+	/* String offsets of the string or of the URI components, in the order
+	   they appear in gcfg_value_t, 0 if not set */
+	uint32_t strings[6];
+
+	/* Line number of the node, as reported by gcfg_reader_next */
+	uint32_t line;
+
+	/* For blocks, line number of the '}' that closes them and, if the
+	   keyword has a listing, string offset of that line, 0 otherwise */
+	uint32_t end_line;
+	uint32_t end;
+
+	/* The argument, with all string pointers set to NULL */
+	gcfg_value_t value;
+} gcfg_node_t;
+
+typedef struct gcfg_document_t gcfg_document_t;
+
+typedef struct gcfg_tracker_t gcfg_tracker_t;
+
+typedef struct gcfg_watch_t gcfg_watch_t;
+
+typedef enum {
+	/* A top-level declaration that was not there before */
+	GCFG_CHANGE_ADDED = 1,
+
+	/* A top-level declaration that is gone */
+	GCFG_CHANGE_REMOVED,
+
+	/* A top-level declaration with the same first line, but different
+	   content */
+	GCFG_CHANGE_CHANGED,
+} GCFG_CHANGE_TYPE;
+
+typedef enum {
+	/* Malformed line, e.g. extra tokens after a keyword or a brace */
+	GCFG_DIAG_SYNTAX = 1,
+
+	/* The line is not valid UTF-8 */
+	GCFG_DIAG_ENCODING,
+
+	/* The keyword is not known in the current block */
+	GCFG_DIAG_UNKNOWN_KEYWORD,
+
+	/* Missing, unexpected or malformed keyword argument */
+	GCFG_DIAG_ARGUMENT,
+
+	/* Unbalanced braces or blocks nested too deeply */
+	GCFG_DIAG_NESTING,
+
+	/* A keyword callback failed */
+	GCFG_DIAG_CALLBACK,
+} GCFG_DIAG_CODE;
+
+#define GCFG_DIAG_MESSAGE_MAX (128)
+
+/* An error found by gcfg_parse_file_recover */
+typedef struct {
+	/* Line number, counting from 1 */
+	unsigned long line;
+
+	/* Byte offset of the offending token in the line, counting from 1,
+	   or 0 if the error concerns the line as a whole */
+	unsigned long column;
+
+	/* A GCFG_DIAG_CODE */
+	int code;
+
+	/* The message that would have been passed to report_error,
+	   truncated if necessary */
+	char message[GCFG_DIAG_MESSAGE_MAX];
+} gcfg_diagnostic_t;
+
+typedef enum {
+	/* Unknown keywords are skipped along with their arguments and, if
+	   they open a block, everything in it. The block is only scanned for
+	   braces outside of strings and comments, nothing in it is checked, not
+   even whether it is valid UTF-8. */
+	GCFG_PARSE_TOLERANT = 0x01,
+} GCFG_PARSE_FLAGS;
+
+typedef enum {
+	/* Keyword callbacks are called from the worker threads as soon as a
+	   declaration is parsed, instead of in the order of the input */
+	GCFG_PARALLEL_UNORDERED = 0x01,
+} GCFG_PARALLEL_FLAGS;
+
 
 #define GCFG_BEGIN_ENUM(name) static const gcfg_enum_t name[] = {
 
@@ -147,6 +402,31 @@ typedef struct gcfg_keyword_t {
 		.finalize_object = finalize, \
 	}
 
+/* A keyword with GCFG_KEYWORD_DEFERRED, the body of its block is handed to
+   deferred, which can be NULL to skip it */
+#define GCFG_KEYWORD_DEFERRED_BASE(nam, karg, elist, clist, cb, finalize, \
+				   deferred) \
+	{ \
+		.name = nam, \
+		.arg = karg, \
+		.option = { .enumtokens = elist, }, \
+		.flags = GCFG_KEYWORD_DEFERRED, \
+		.children = clist, \
+		.set_property = cb, \
+		.finalize_object = finalize, \
+		.handle_deferred = deferred, \
+	}
+
+/* A keyword with GCFG_KEYWORD_BATCH, its values are handed to batch */
+#define GCFG_KEYWORD_BATCH_BASE(nam, karg, elist, batch) \
+	{ \
+		.name = nam, \
+		.arg = karg, \
+		.option = { .enumtokens = elist, }, \
+		.flags = GCFG_KEYWORD_BATCH, \
+		.handle_batch = batch, \
+	}
+
 #define GCFG_BEGIN_KEYWORDS(listname) \
 	static const gcfg_keyword_t listname[] = {
 
@@ -219,10 +499,244 @@ double gcfg_number_to_double(const gcfg_value_t *num, size_t index);
 int gcfg_parse_file(gcfg_file_t *file, const gcfg_keyword_t *keywords,
 		    void *usr);
 
+/* Same as gcfg_parse_file, but blocks can be nested at most max_depth levels
+   deep. The stack must have room for max_depth entries. If it is NULL, a
+   stack of that size is allocated instead. */
+int gcfg_parse_file_depth(gcfg_file_t *file, const gcfg_keyword_t *keywords,
+			  void *usr, gcfg_block_t *stack, size_t max_depth);
+
+/* Same as gcfg_parse_file, but behavior can be changed through a
+   combination of GCFG_PARSE_FLAGS. */
+int gcfg_parse_file_flags(gcfg_file_t *file, const gcfg_keyword_t *keywords,
+			  void *usr, uint32_t flags);
+
+/* Checks a file against a keyword list, including the syntax and the
+   arguments of all keywords, without calling any of the callbacks. As with
+   gcfg_reader_next, listings end at a line consisting only of '}'. Does not
+   allocate memory or touch global state, so separate files can be checked
+   on separate threads at the same time. Returns 0 if the file is valid, -1
+   after reporting the first error otherwise. */
+int gcfg_validate_file(gcfg_file_t *file, const gcfg_keyword_t *keywords);
+
+/* Same as gcfg_parse_file, but does not stop at the first error. The line
+   that failed, or the whole block if it opens one, is skipped and parsing
+   continues after it. Instead of passing errors to report_error, up to max
+   of them are stored in diag and their number in count. Parsing stops once
+   max errors have been found, or if reading the file fails. The callbacks
+   are handed a stand-in for the file that reads from it and records the
+   errors reported through it. Returns 0 if the file was parsed without
+   errors, -1 otherwise. */
+int gcfg_parse_file_recover(gcfg_file_t *file, const gcfg_keyword_t *keywords,
+			    void *usr, gcfg_diagnostic_t *diag, size_t max,
+			    size_t *count);
+
 gcfg_file_t *gcfg_file_open(const char *path);
 
+/* Same as gcfg_file_open, but maps the whole file into memory and hands out
+   lines directly from the mapping instead of copying them into a buffer. */
+gcfg_file_t *gcfg_file_open_mmap(const char *path);
+
+/* Same as gcfg_file_open, but the next chunk of the file is read on a helper
+   thread while the parser works on the current one. Falls back to
+   gcfg_file_open if built without thread support. */
+gcfg_file_t *gcfg_file_open_async(const char *path);
+
+/* Same as gcfg_file_open, but transparently decompresses gzip or zstd
+   compressed files, depending on the magic bytes at the start. Uncompressed
+   files are read as is. If the library is built without support for a
+   format, or without malloc, a compressed file is rejected with a
+   "decompression not supported" error. */
+gcfg_file_t *gcfg_file_open_compressed(const char *path);
+
+/* Parses a caller owned buffer, which must stay valid until the file is
+   closed. The name is used for error messages only. */
+gcfg_file_t *gcfg_file_open_memory(const char *name, const char *data,
+				  size_t size);
+
 void gcfg_file_close(gcfg_file_t *file);
 
+/* Builds an index of line start offsets in a single pass over the input and
+   rewinds the file to the first line. Supported for files opened through
+   gcfg_file_open, gcfg_file_open_mmap and gcfg_file_open_memory. */
+int gcfg_file_build_index(gcfg_file_t *file);
+
+/* Using the index, repositions the file so that the next line fetched is
+   the line with the given number, counting from 1 as in error messages. */
+int gcfg_file_seek_line(gcfg_file_t *file, unsigned long line);
+
+/* Same as gcfg_file_seek_line, but seeks to the start of the line that
+   contains the given byte offset. */
+int gcfg_file_seek_offset(gcfg_file_t *file, uint64_t offset);
+
+/* Parses the body of a deferred block, using the children of its keyword,
+   into the object set_property returned for it. The file is repositioned
+   through its index, see gcfg_file_build_index. Line numbers in the body
+   must count from the start of the file, i.e. the file it was found in must
+   have been parsed from the first line on. The object is not finalized. */
+int gcfg_parse_deferred(gcfg_file_t *file, const gcfg_deferred_t *body,
+			void *object);
+
+/* Creates a reader that pulls events from a file one at a time, instead of
+   calling into the keyword callbacks, which are ignored. Blocks can be nested
+   at most max_depth levels deep. The file is not closed by the reader. */
+gcfg_reader_t *gcfg_reader_create(gcfg_file_t *file,
+				  const gcfg_keyword_t *keywords,
+				  size_t max_depth);
+
+/* Fetches the next event. Returns 0 on success, > 0 at the end of the file
+   and < 0 on failure, after reporting the error. Strings in the event stay
+   valid until the next call. Inside a listing, every line is reported as is,
+   until a line consisting only of '}' ends the block. */
+int gcfg_reader_next(gcfg_reader_t *rd, gcfg_event_t *ev);
+
+void gcfg_reader_destroy(gcfg_reader_t *rd);
+
+/* Creates a parser that is fed the input in arbitrary pieces, e.g. as it
+   arrives on a non-blocking socket, instead of reading it from a file. The
+   name is used for error messages only. */
+gcfg_parser_t *gcfg_parser_create(const char *name,
+				  const gcfg_keyword_t *keywords, void *usr,
+				  size_t max_depth);
+
+/* Processes all lines completed by the data and calls the keyword callbacks
+   for them. A trailing partial line and the open blocks are kept until the
+   next call. Returns 0 on success, -1 on failure after reporting the error.
+   After a failure, all further calls fail. */
+int gcfg_parser_feed(gcfg_parser_t *parser, const void *data, size_t size);
+
+/* Marks the end of the input, processes a last line without line break and
+   checks that all blocks are closed. Returns the same as gcfg_parser_feed. */
+int gcfg_parser_finish(gcfg_parser_t *parser);
+
+void gcfg_parser_destroy(gcfg_parser_t *parser);
+
+/* Parses a file into a document instead of calling the keyword callbacks,
+   which are ignored. Listings end at a line consisting only of '}'. All
+   nodes and strings are kept in a single allocation. Returns NULL on
+   failure, after reporting the error. */
+gcfg_document_t *gcfg_parse_document(gcfg_file_t *file,
+				     const gcfg_keyword_t *keywords);
+
+void gcfg_document_free(gcfg_document_t *doc);
+
+/* Returns the number of nodes in a document, including the root. */
+size_t gcfg_document_node_count(const gcfg_document_t *doc);
+
+/* Returns a node by index, or NULL if it is out of range. */
+const gcfg_node_t *gcfg_document_node(const gcfg_document_t *doc,
+				      uint32_t index);
+
+/* Resolves a string offset of a node, returns NULL for offset 0. */
+const char *gcfg_document_string(const gcfg_document_t *doc,
+				 uint32_t offset);
+
+/* Copies the argument of a node with the string pointers resolved. */
+void gcfg_node_get_value(const gcfg_document_t *doc, const gcfg_node_t *node,
+			 gcfg_value_t *out);
+
+/* Writes a document to a binary cache file at path, which records the size,
+   modification time and a content hash of the source file it was parsed
+   from and a hash of the keyword lists used. The file is replaced
+   atomically. Returns 0 on success, -1 on failure after printing an
+   error message. Configurations with more than 256 distinct keyword
+   lists cannot be cached. */
+int gcfg_document_save(const gcfg_document_t *doc,
+		       const gcfg_keyword_t *keywords, const char *source,
+		       const char *path);
+
+/* Maps a document from a cache file written by gcfg_document_save. Returns
+   NULL if the cache file does not exist, is damaged or does not match the
+   source file and keyword lists anymore. */
+gcfg_document_t *gcfg_document_load(const gcfg_keyword_t *keywords,
+				    const char *source, const char *path);
+
+/* Loads the document for a source file from the cache at path if it is up
+   to date. Otherwise, parses the source file and tries to update the
+   cache. */
+gcfg_document_t *gcfg_parse_document_cached(const char *source,
+					    const gcfg_keyword_t *keywords,
+					    const char *path);
+
+/* Parses a file on multiple threads. The input is split at top-level
+   declarations, which are parsed in parallel. If threads is 0, one thread
+   per processor is used. By default, the callbacks are called on the
+   calling thread in the order of the input. With GCFG_PARALLEL_UNORDERED,
+   they are called from the worker threads concurrently and must be thread
+   safe. As with gcfg_reader_next, listings end at a line consisting only of
+   '}'. Falls back to parsing on the calling thread if built without thread
+   support. */
+int gcfg_parse_path_parallel(const char *path, const gcfg_keyword_t *keywords,
+			     void *usr, unsigned int threads,
+			     uint32_t flags);
+
+/* Creates a tracker that remembers a hash of each top-level declaration of a
+   file, so it can be reparsed incrementally. A declaration is identified by
+   its first line without surrounding space, e.g. the keyword and argument
+   of a block. Declarations without a block thus show up as removed and
+   added if they are edited.
+
+   The change callback is called with a GCFG_CHANGE_TYPE and the first line
+   of the declaration. It returns 0 on success, -1 to stop the update. */
+gcfg_tracker_t *gcfg_tracker_create(const gcfg_keyword_t *keywords,
+				    int (*change)(void *usr, int type,
+						  const char *line));
+
+/* Parses a file, calling the keyword callbacks only for declarations that
+   were added or changed since the last update. On the first update, every
+   declaration counts as added. Removed declarations are reported first,
+   then the added and changed ones in the order of the file, each right
+   before its keyword callbacks are called. Returns 0 on success, -1 on
+   failure. After a failure, the tracker remembers the declarations as the
+   callbacks have seen them. Those whose callbacks already ran are reported
+   as changed by the next update, or as removed if they are gone, the
+   others are compared against the version from before the failure. */
+int gcfg_tracker_update(gcfg_tracker_t *tracker, const char *path,
+			void *usr);
+
+void gcfg_tracker_destroy(gcfg_tracker_t *tracker);
+
+gcfg_include_cache_t *gcfg_include_cache_create(void);
+
+void gcfg_include_cache_destroy(gcfg_include_cache_t *cache);
+
+/* Opens and parses a file, processing 'include "<path>"' directives. Paths
+   are relative to the including file and can contain wildcards. The cache
+   remembers the files that make up the configuration, for
+   gcfg_watch_create, along with the declarations parsed from each of them.
+   Files are identified by inode and revalidated by size and modification
+   time. The declarations of a file that did not change, whether included
+   again by a later call or a second time by the same one, are handed to
+   the callbacks from the cache, without reading the file. Callbacks must
+   not modify the strings they are handed for that reason. Files with
+   deferred blocks are always read again. Including a file that is
+   currently being parsed is reported as an error. */
+int gcfg_parse_path(const char *path, const gcfg_keyword_t *keywords,
+		    void *usr, gcfg_include_cache_t *cache);
+
+/* Watches a configuration file and all files it includes through inotify.
+   The reload callback is expected to parse the file through
+   gcfg_parse_path with the cache it is given, which tells the watcher
+   which files to watch. It is called once right away and again whenever
+   the configuration changed, after no further change was seen for debounce
+   milliseconds. Returns NULL on failure, including if the first reload
+   fails. */
+gcfg_watch_t *gcfg_watch_create(const char *path, unsigned int debounce,
+				int (*reload)(void *usr, const char *path,
+					      gcfg_include_cache_t *cache),
+				void *usr);
+
+/* Returns a file descriptor that becomes readable when a change is pending,
+   to integrate the watcher into a poll loop. */
+int gcfg_watch_fd(const gcfg_watch_t *watch);
+
+/* Waits up to timeout milliseconds for a change, or forever if negative,
+   and then calls the reload callback. Returns 1 after a successful reload,
+   0 if nothing changed, -1 if reading the changes or the reload failed.
+   The watcher can be used further after a failed reload. */
+int gcfg_watch_dispatch(gcfg_watch_t *watch, int timeout);
+
+void gcfg_watch_destroy(gcfg_watch_t *watch);
+
 
 
 
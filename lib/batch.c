@@ -0,0 +1,210 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * batch.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define URI_STRINGS (6)
+
+static void *current_object(const gcfg_parse_ctx_t *ctx)
+{
+	return ctx->depth > 0 ? ctx->stack[ctx->depth - 1].object :
+		ctx->object;
+}
+
+#ifdef GCFG_DISABLE_ALLOC
+int gcfg_batch_add(gcfg_file_t *file, gcfg_parse_ctx_t *ctx,
+		   const gcfg_keyword_t *kwd, const gcfg_value_t *value)
+{
+	ctx->error = GCFG_DIAG_CALLBACK;
+
+	if (kwd->handle_batch == NULL)
+		return 0;
+
+	return kwd->handle_batch(file, current_object(ctx), value, 1);
+}
+
+int gcfg_batch_flush(gcfg_file_t *file, gcfg_parse_ctx_t *ctx)
+{
+	(void)file; (void)ctx;
+	return 0;
+}
+
+void gcfg_batch_cleanup(gcfg_parse_ctx_t *ctx)
+{
+	(void)ctx;
+}
+#else
+int gcfg_batch_store_string(gcfg_batch_t *batch, const char *str,
+			    size_t *out)
+{
+	size_t len, size;
+	char *new;
+
+	if (str == NULL) {
+		*out = 0;
+		return 0;
+	}
+
+	len = strlen(str) + 1;
+
+	/* offset 0 is never used by a string, so it can stand for NULL */
+	if (batch->used == 0)
+		batch->used = 1;
+
+	if (batch->strings == NULL || batch->size - batch->used < len) {
+		size = batch->size ? batch->size : 4096;
+		while (size - batch->used < len)
+			size *= 2;
+
+		new = realloc(batch->strings, size);
+		if (new == NULL)
+			return -1;
+
+		batch->strings = new;
+		batch->size = size;
+	}
+
+	memcpy(batch->strings + batch->used, str, len);
+	*out = batch->used;
+	batch->used += len;
+	return 0;
+}
+
+int gcfg_batch_store(gcfg_batch_t *batch, const gcfg_value_t *value)
+{
+	const char *str[URI_STRINGS];
+	size_t i, count = 0;
+	gcfg_value_t *val;
+	size_t *offsets;
+	size_t max;
+	void *new;
+
+	if (batch->count == batch->max) {
+		max = batch->max ? batch->max * 2 : 64;
+
+		new = realloc(batch->values, max * sizeof(batch->values[0]));
+		if (new == NULL)
+			return -1;
+		batch->values = new;
+
+		new = realloc(batch->offsets,
+			      max * URI_STRINGS * sizeof(batch->offsets[0]));
+		if (new == NULL)
+			return -1;
+		batch->offsets = new;
+
+		batch->max = max;
+	}
+
+	val = batch->values + batch->count;
+	offsets = batch->offsets + batch->count * URI_STRINGS;
+	*val = *value;
+
+	if (value->type == GCFG_VALUE_STRING) {
+		str[count++] = value->data.string;
+	} else if (value->type == GCFG_VALUE_URI) {
+		str[count++] = value->data.uri.scheme;
+		str[count++] = value->data.uri.userinfo;
+		str[count++] = value->data.uri.host;
+		str[count++] = value->data.uri.path;
+		str[count++] = value->data.uri.query;
+		str[count++] = value->data.uri.fragment;
+	}
+
+	for (i = 0; i < URI_STRINGS; ++i)
+		offsets[i] = 0;
+
+	for (i = 0; i < count; ++i) {
+		if (gcfg_batch_store_string(batch, str[i], offsets + i))
+			return -1;
+	}
+
+	batch->count += 1;
+	return 0;
+}
+
+static char *get_string(const gcfg_batch_t *batch, size_t offset)
+{
+	return offset == 0 ? NULL : batch->strings + offset;
+}
+
+void gcfg_batch_resolve(gcfg_batch_t *batch)
+{
+	const size_t *offsets;
+	gcfg_value_t *val;
+	size_t i;
+
+	for (i = 0; i < batch->count; ++i) {
+		val = batch->values + i;
+		offsets = batch->offsets + i * URI_STRINGS;
+
+		if (val->type == GCFG_VALUE_STRING) {
+			val->data.string = get_string(batch, offsets[0]);
+		} else if (val->type == GCFG_VALUE_URI) {
+			val->data.uri.scheme = get_string(batch, offsets[0]);
+			val->data.uri.userinfo = get_string(batch, offsets[1]);
+			val->data.uri.host = get_string(batch, offsets[2]);
+			val->data.uri.path = get_string(batch, offsets[3]);
+			val->data.uri.query = get_string(batch, offsets[4]);
+			val->data.uri.fragment = get_string(batch,
+							    offsets[5]);
+		}
+	}
+}
+
+int gcfg_batch_add(gcfg_file_t *file, gcfg_parse_ctx_t *ctx,
+		   const gcfg_keyword_t *kwd, const gcfg_value_t *value)
+{
+	gcfg_batch_t *batch = &ctx->batch;
+
+	if (batch->count == 0) {
+		batch->keyword = kwd;
+		batch->parent = current_object(ctx);
+	}
+
+	if (gcfg_batch_store(batch, value)) {
+		ctx->error = GCFG_DIAG_CALLBACK;
+		file->report_error(file, "out of memory");
+		return -1;
+	}
+
+	return 0;
+}
+
+int gcfg_batch_flush(gcfg_file_t *file, gcfg_parse_ctx_t *ctx)
+{
+	gcfg_batch_t *batch = &ctx->batch;
+	const gcfg_keyword_t *kwd = batch->keyword;
+	size_t count = batch->count;
+
+	if (count == 0)
+		return 0;
+
+	gcfg_batch_resolve(batch);
+
+	/* emptied first, so a failure does not deliver the values again */
+	batch->count = 0;
+	batch->used = 0;
+
+	ctx->error = GCFG_DIAG_CALLBACK;
+
+	if (kwd->handle_batch == NULL)
+		return 0;
+
+	return kwd->handle_batch(file, batch->parent, batch->values, count);
+}
+
+void gcfg_batch_cleanup(gcfg_parse_ctx_t *ctx)
+{
+	free(ctx->batch.values);
+	free(ctx->batch.offsets);
+	free(ctx->batch.strings);
+	memset(&ctx->batch, 0, sizeof(ctx->batch));
+}
+#endif
@@ -0,0 +1,500 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * doc_cache.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define CACHE_MAGIC "GCFGDOC2"
+#define CACHE_BYTE_ORDER (0x01020304)
+
+/* distinct keyword lists that can be hashed, more disable the cache */
+#define MAX_KEYWORD_LISTS (256)
+
+/*
+  A cache file is this header, followed by the document exactly as it is
+  laid out in memory. The document is only used if the source file still
+  has the recorded size, time stamp and content hash, and if it was
+  produced for the same keyword lists, including their flags and enum
+  tables, on a compatible machine.
+*/
+typedef struct {
+	char magic[8];
+	uint32_t byte_order;
+	uint32_t node_size;
+
+	uint64_t source_size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t source_hash;
+	uint64_t keyword_hash;
+
+	uint64_t doc_size;
+} cache_header_t;
+
+typedef struct {
+	const gcfg_keyword_t *lists[MAX_KEYWORD_LISTS];
+	size_t count;
+	uint64_t hash;
+	bool overflow;
+} keyword_hash_t;
+
+static void hash_enum(keyword_hash_t *kh, const gcfg_enum_t *tokens)
+{
+	if (tokens == NULL)
+		return;
+
+	/* documents store the value a token resolves to */
+	for (; tokens->name != NULL; ++tokens) {
+		kh->hash = gcfg_hash_bytes(kh->hash, tokens->name,
+				   strlen(tokens->name) + 1);
+		kh->hash = gcfg_hash_bytes(kh->hash, &tokens->value,
+				   sizeof(tokens->value));
+	}
+
+	kh->hash = gcfg_hash_bytes(kh->hash, "", 1);
+}
+
+static void hash_keywords(keyword_hash_t *kh, const gcfg_keyword_t *list)
+{
+	size_t i;
+
+	if (list == NULL || kh->overflow)
+		return;
+
+	for (i = 0; i < kh->count; ++i) {
+		if (kh->lists[i] == list)
+			return;
+	}
+
+	if (kh->count == MAX_KEYWORD_LISTS) {
+		kh->overflow = true;
+		return;
+	}
+
+	kh->lists[kh->count++] = list;
+
+	for (; list->name != NULL; ++list) {
+		kh->hash = gcfg_hash_bytes(kh->hash, list->name,
+				   strlen(list->name) + 1);
+		kh->hash = gcfg_hash_bytes(kh->hash, &list->arg,
+				   sizeof(list->arg));
+		kh->hash = gcfg_hash_bytes(kh->hash, &list->flags,
+				   sizeof(list->flags));
+		kh->hash = gcfg_hash_bytes(kh->hash,
+				   list->handle_listing ? "L" : "-", 1);
+
+		if (list->arg == GCFG_VALUE_ENUM)
+			hash_enum(kh, list->option.enumtokens);
+
+		hash_keywords(kh, list->children);
+	}
+
+	kh->hash = gcfg_hash_bytes(kh->hash, "", 1);
+}
+
+/* fails if the keyword lists are too many to be hashed */
+static int init_header(cache_header_t *hdr, const gcfg_keyword_t *keywords)
+{
+	keyword_hash_t kh;
+
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic));
+	hdr->byte_order = CACHE_BYTE_ORDER;
+	hdr->node_size = sizeof(gcfg_node_t);
+
+	memset(&kh, 0, sizeof(kh));
+	kh.hash = GCFG_HASH_SEED;
+	hash_keywords(&kh, keywords);
+	hdr->keyword_hash = kh.hash;
+	return kh.overflow ? -1 : 0;
+}
+
+/*
+  Reads the source file and records its size, time stamp and hash in the
+  header. If cached is set and the size or time stamp differ from it, the
+  file is not read and > 0 is returned. If data is not NULL, the caller
+  has to free the buffer stored there.
+*/
+static int read_source(cache_header_t *hdr, const char *source,
+		       const cache_header_t *cached, char **data)
+{
+	struct stat sb;
+	char *buffer;
+	size_t size;
+	int fd;
+
+	fd = open(source, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &sb) != 0)
+		goto fail;
+
+	hdr->source_size = (uint64_t)sb.st_size;
+	hdr->mtime_sec = (int64_t)sb.st_mtim.tv_sec;
+	hdr->mtime_nsec = (int64_t)sb.st_mtim.tv_nsec;
+
+	if (cached != NULL && (cached->source_size != hdr->source_size ||
+			       cached->mtime_sec != hdr->mtime_sec ||
+			       cached->mtime_nsec != hdr->mtime_nsec)) {
+		close(fd);
+		return 1;
+	}
+
+	buffer = gcfg_read_fd(fd, &size);
+	if (buffer == NULL)
+		goto fail;
+
+	close(fd);
+
+	/* exactly what was read, even if the file changed in between */
+	hdr->source_size = size;
+	hdr->source_hash = gcfg_hash_bytes(GCFG_HASH_SEED, buffer, size);
+
+	if (data != NULL) {
+		*data = buffer;
+	} else {
+		free(buffer);
+	}
+	return 0;
+fail:
+	close(fd);
+	return -1;
+}
+
+static size_t document_size(const gcfg_document_t *doc)
+{
+	return sizeof(*doc) + doc->node_count * sizeof(doc->nodes[0]) +
+		doc->string_size;
+}
+
+static int write_all(int fd, const void *data, size_t size)
+{
+	const char *ptr = data;
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = write(fd, ptr, size);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		ptr += ret;
+		size -= (size_t)ret;
+	}
+
+	return 0;
+}
+
+static int write_cache(const gcfg_document_t *doc, cache_header_t *hdr,
+		       const char *path)
+{
+	gcfg_document_t copy;
+	char *temp;
+	int fd;
+
+	hdr->doc_size = document_size(doc);
+
+	/* write to a temporary file and rename it, readers never see a
+	   partially written cache */
+	temp = malloc(strlen(path) + 8);
+	if (temp == NULL)
+		goto fail_errno;
+
+	sprintf(temp, "%s.XXXXXX", path);
+
+	fd = mkstemp(temp);
+	if (fd < 0) {
+		free(temp);
+		goto fail_errno;
+	}
+
+	copy = *doc;
+	copy.map_size = 0;
+
+	if (write_all(fd, hdr, sizeof(*hdr)) ||
+	    write_all(fd, &copy, sizeof(copy)) ||
+	    write_all(fd, doc->nodes, hdr->doc_size - sizeof(copy))) {
+		goto fail_temp;
+	}
+
+	if (close(fd) != 0) {
+		fd = -1;
+		goto fail_temp;
+	}
+
+	if (rename(temp, path) != 0) {
+		fd = -1;
+		goto fail_temp;
+	}
+
+	free(temp);
+	return 0;
+fail_temp:
+	dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+	if (fd >= 0)
+		close(fd);
+	unlink(temp);
+	free(temp);
+	return -1;
+fail_errno:
+	dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+	return -1;
+}
+
+int gcfg_document_save(const gcfg_document_t *doc,
+		       const gcfg_keyword_t *keywords, const char *source,
+		       const char *path)
+{
+	cache_header_t hdr;
+
+	if (init_header(&hdr, keywords)) {
+		dprintf(STDERR_FILENO, "%s: too many keyword lists to be "
+			"cached\n", path);
+		return -1;
+	}
+
+	if (read_source(&hdr, source, NULL, NULL)) {
+		dprintf(STDERR_FILENO, "%s: %s\n", source, strerror(errno));
+		return -1;
+	}
+
+	return write_cache(doc, &hdr, path);
+}
+
+static size_t list_length(const gcfg_keyword_t *list)
+{
+	size_t count = 0;
+
+	while (list[count].name != NULL)
+		++count;
+
+	return count;
+}
+
+/*
+  Links a node to the keyword list its keyword index refers to. Nodes may
+  only be linked once, and only from a node before them, so the links form
+  a tree that can be walked without running into cycles.
+*/
+static bool link_node(const gcfg_keyword_t **lists, uint32_t from,
+		      uint32_t idx, uint32_t count,
+		      const gcfg_keyword_t *list)
+{
+	if (idx == 0)
+		return true;
+
+	if (idx <= from || idx >= count || lists[idx] != NULL)
+		return false;
+
+	lists[idx] = list;
+	return true;
+}
+
+/*
+  Checks the structure of a mapped document, so a damaged cache cannot
+  make readers loop or index past a keyword list. Lines of a listing are
+  linked to the list of the block holding them, their keyword index is
+  not used.
+*/
+static bool check_nodes(const gcfg_document_t *doc,
+			const gcfg_keyword_t *keywords)
+{
+	const gcfg_keyword_t **lists, *list, *sub = NULL, *last = NULL;
+	const gcfg_node_t *node;
+	size_t length = 0;
+	bool ret = false;
+	uint32_t i, j;
+
+	lists = calloc(doc->node_count, sizeof(lists[0]));
+	if (lists == NULL)
+		return false;
+
+	if (doc->nodes[0].type != GCFG_NODE_ROOT || doc->nodes[0].next != 0 ||
+	    !link_node(lists, 0, doc->nodes[0].child, doc->node_count,
+		       keywords)) {
+		goto out;
+	}
+
+	for (i = 1; i < doc->node_count; ++i) {
+		node = doc->nodes + i;
+		list = lists[i];
+
+		if (list == NULL || node->name >= doc->string_size)
+			goto out;
+
+		for (j = 0; j < 6; ++j) {
+			if (node->strings[j] >= doc->string_size)
+				goto out;
+		}
+
+		if (!link_node(lists, i, node->next, doc->node_count, list))
+			goto out;
+
+		if (node->type == GCFG_NODE_LISTING_LINE) {
+			if (node->child != 0)
+				goto out;
+			continue;
+		}
+
+		if (node->type != GCFG_NODE_KEYWORD &&
+		    node->type != GCFG_NODE_BLOCK) {
+			goto out;
+		}
+
+		if (list != last) {
+			length = list_length(list);
+			last = list;
+		}
+
+		if (node->keyword >= length)
+			goto out;
+
+		if (node->type == GCFG_NODE_KEYWORD) {
+			if (node->child != 0)
+				goto out;
+			continue;
+		}
+
+		if (list[node->keyword].handle_listing != NULL) {
+			sub = list;
+		} else {
+			sub = list[node->keyword].children;
+			if (sub == NULL && node->child != 0)
+				goto out;
+		}
+
+		if (!link_node(lists, i, node->child, doc->node_count, sub))
+			goto out;
+	}
+
+	ret = true;
+out:
+	free(lists);
+	return ret;
+}
+
+static bool is_valid(const cache_header_t *cached, const cache_header_t *hdr,
+		     const gcfg_document_t *doc, size_t size,
+		     const gcfg_keyword_t *keywords)
+{
+	const char *strings;
+
+	if (memcmp(cached, hdr, offsetof(cache_header_t, doc_size)) != 0)
+		return false;
+
+	if (cached->doc_size != size - sizeof(*cached) ||
+	    cached->doc_size < sizeof(*doc)) {
+		return false;
+	}
+
+	if (doc->node_count == 0 || doc->string_size == 0 ||
+	    document_size(doc) != cached->doc_size) {
+		return false;
+	}
+
+	strings = (const char *)(doc->nodes + doc->node_count);
+	if (strings[doc->string_size - 1] != '\0')
+		return false;
+
+	return check_nodes(doc, keywords);
+}
+
+gcfg_document_t *gcfg_document_load(const gcfg_keyword_t *keywords,
+				    const char *source, const char *path)
+{
+	const cache_header_t *cached;
+	gcfg_document_t *doc;
+	cache_header_t hdr;
+	struct stat sb;
+	char *data;
+	size_t size;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &sb) != 0 || (uint64_t)sb.st_size > SIZE_MAX ||
+	    (size_t)sb.st_size < sizeof(hdr) + sizeof(*doc)) {
+		close(fd);
+		return NULL;
+	}
+
+	size = (size_t)sb.st_size;
+
+	/* private and writable, so map_size can be stored in place */
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return NULL;
+
+	cached = (const cache_header_t *)(void *)data;
+	doc = (gcfg_document_t *)(void *)(data + sizeof(hdr));
+
+	if (init_header(&hdr, keywords) != 0 ||
+	    read_source(&hdr, source, cached, NULL) != 0 ||
+	    !is_valid(cached, &hdr, doc, size, keywords)) {
+		munmap(data, size);
+		return NULL;
+	}
+
+	doc->map_size = size;
+	return doc;
+}
+
+void gcfg_document_unmap(gcfg_document_t *doc)
+{
+	munmap((char *)doc - sizeof(cache_header_t), (size_t)doc->map_size);
+}
+
+gcfg_document_t *gcfg_parse_document_cached(const char *source,
+					    const gcfg_keyword_t *keywords,
+					    const char *path)
+{
+	gcfg_document_t *doc;
+	cache_header_t hdr;
+	gcfg_file_t *file;
+	bool usable;
+	char *data;
+
+	doc = gcfg_document_load(keywords, source, path);
+	if (doc != NULL)
+		return doc;
+
+	/* parse exactly the data that was hashed */
+	usable = init_header(&hdr, keywords) == 0;
+
+	if (read_source(&hdr, source, NULL, &data)) {
+		dprintf(STDERR_FILENO, "%s: %s\n", source, strerror(errno));
+		return NULL;
+	}
+
+	file = gcfg_file_open_memory(source, data, hdr.source_size);
+	if (file != NULL) {
+		doc = gcfg_parse_document(file, keywords);
+		gcfg_file_close(file);
+	}
+
+	free(data);
+
+	/* a failure to update the cache only costs time on the next run */
+	if (doc != NULL && usable)
+		write_cache(doc, &hdr, path);
+
+	return doc;
+}
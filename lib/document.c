@@ -0,0 +1,339 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * document.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define URI_STRINGS (6)
+
+/* number of slots in the cache of keyword name offsets */
+#define NAME_CACHE (64)
+
+/*
+  While parsing, nodes and strings are collected in two growing arrays,
+  which are joined into a single document once the file is done.
+*/
+typedef struct {
+	gcfg_node_t *nodes;
+	size_t count;
+	size_t max;
+
+	char *strings;
+	size_t size;
+	size_t max_size;
+
+	/* node indices of the open blocks and of their last child so far */
+	uint32_t parent[GCFG_DEFAULT_MAX_DEPTH + 1];
+	uint32_t last[GCFG_DEFAULT_MAX_DEPTH + 1];
+
+	/* keyword list of each open block */
+	const gcfg_keyword_t *list[GCFG_DEFAULT_MAX_DEPTH + 1];
+	size_t depth;
+
+	/* keywords whose name is already stored, so it can be shared */
+	const gcfg_keyword_t *name_kwd[NAME_CACHE];
+	uint32_t name_offset[NAME_CACHE];
+} builder_t;
+
+static int add_string(builder_t *b, const char *str, uint32_t *out)
+{
+	size_t len, size;
+	char *new;
+
+	if (str == NULL) {
+		*out = 0;
+		return 0;
+	}
+
+	len = strlen(str) + 1;
+
+	if (len > UINT32_MAX - b->size)
+		return -1;
+
+	if (b->size + len > b->max_size) {
+		size = b->max_size ? b->max_size : 4096;
+		while (size < b->size + len)
+			size *= 2;
+
+		new = realloc(b->strings, size);
+		if (new == NULL)
+			return -1;
+
+		b->strings = new;
+		b->max_size = size;
+	}
+
+	memcpy(b->strings + b->size, str, len);
+	*out = (uint32_t)b->size;
+	b->size += len;
+	return 0;
+}
+
+static int add_name(builder_t *b, const gcfg_keyword_t *kwd, uint32_t *out)
+{
+	size_t slot = ((uintptr_t)kwd / sizeof(*kwd)) % NAME_CACHE;
+
+	if (b->name_kwd[slot] != kwd) {
+		if (add_string(b, kwd->name, b->name_offset + slot))
+			return -1;
+
+		b->name_kwd[slot] = kwd;
+	}
+
+	*out = b->name_offset[slot];
+	return 0;
+}
+
+/* appends a node as the last child of the innermost open block */
+static gcfg_node_t *add_node(builder_t *b, uint32_t type, uint32_t *out)
+{
+	gcfg_node_t *new;
+	uint32_t idx;
+	size_t size;
+
+	if (b->count == UINT32_MAX)
+		return NULL;
+
+	if (b->count == b->max) {
+		size = b->max ? b->max * 2 : 256;
+
+		new = realloc(b->nodes, size * sizeof(new[0]));
+		if (new == NULL)
+			return NULL;
+
+		b->nodes = new;
+		b->max = size;
+	}
+
+	idx = (uint32_t)b->count++;
+	new = b->nodes + idx;
+	memset(new, 0, sizeof(*new));
+	new->type = type;
+
+	if (idx > 0) {
+		if (b->last[b->depth] == 0) {
+			b->nodes[b->parent[b->depth]].child = idx;
+		} else {
+			b->nodes[b->last[b->depth]].next = idx;
+		}
+
+		b->last[b->depth] = idx;
+	}
+
+	*out = idx;
+	return new;
+}
+
+static int add_value(builder_t *b, gcfg_node_t *node, const gcfg_value_t *val)
+{
+	const char *str[URI_STRINGS];
+	size_t i, count = 0;
+
+	node->value = *val;
+
+	if (val->type == GCFG_VALUE_STRING) {
+		str[count++] = val->data.string;
+		node->value.data.string = NULL;
+	} else if (val->type == GCFG_VALUE_URI) {
+		str[count++] = val->data.uri.scheme;
+		str[count++] = val->data.uri.userinfo;
+		str[count++] = val->data.uri.host;
+		str[count++] = val->data.uri.path;
+		str[count++] = val->data.uri.query;
+		str[count++] = val->data.uri.fragment;
+
+		node->value.data.uri.scheme = NULL;
+		node->value.data.uri.userinfo = NULL;
+		node->value.data.uri.host = NULL;
+		node->value.data.uri.path = NULL;
+		node->value.data.uri.query = NULL;
+		node->value.data.uri.fragment = NULL;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (add_string(b, str[i], node->strings + i))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int add_event(builder_t *b, const gcfg_event_t *ev)
+{
+	gcfg_node_t *node;
+	uint32_t idx;
+
+	switch (ev->type) {
+	case GCFG_EVENT_BEGIN_BLOCK:
+	case GCFG_EVENT_VALUE:
+		node = add_node(b, ev->type == GCFG_EVENT_BEGIN_BLOCK ?
+				GCFG_NODE_BLOCK : GCFG_NODE_KEYWORD, &idx);
+		if (node == NULL)
+			return -1;
+
+		node->keyword = (uint32_t)(ev->keyword - b->list[b->depth]);
+		node->line = (uint32_t)ev->linenum;
+
+		if (add_name(b, ev->keyword, &node->name))
+			return -1;
+
+		/* node may have moved while adding strings */
+		if (add_value(b, b->nodes + idx, &ev->value))
+			return -1;
+
+		if (ev->type == GCFG_EVENT_BEGIN_BLOCK) {
+			b->depth += 1;
+			b->parent[b->depth] = idx;
+			b->last[b->depth] = 0;
+			b->list[b->depth] = ev->keyword->children;
+		}
+		break;
+	case GCFG_EVENT_LISTING_LINE:
+		node = add_node(b, GCFG_NODE_LISTING_LINE, &idx);
+		if (node == NULL)
+			return -1;
+
+		node->line = (uint32_t)ev->linenum;
+
+		if (add_string(b, ev->line, &node->name))
+			return -1;
+		break;
+	case GCFG_EVENT_END_BLOCK:
+		node = b->nodes + b->parent[b->depth];
+		node->end_line = (uint32_t)ev->linenum;
+
+		/* the closing line is handed to listing callbacks as well */
+		if (add_string(b, ev->line, &node->end))
+			return -1;
+
+		b->depth -= 1;
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static gcfg_document_t *finish(builder_t *b)
+{
+	gcfg_document_t *doc;
+	size_t size;
+
+	size = sizeof(*doc) + b->count * sizeof(b->nodes[0]) + b->size;
+
+	doc = malloc(size);
+	if (doc == NULL)
+		return NULL;
+
+	doc->node_count = (uint32_t)b->count;
+	doc->string_size = (uint32_t)b->size;
+	doc->map_size = 0;
+
+	memcpy(doc->nodes, b->nodes, b->count * sizeof(b->nodes[0]));
+	memcpy(doc->nodes + b->count, b->strings, b->size);
+	return doc;
+}
+
+gcfg_document_t *gcfg_parse_document(gcfg_file_t *file,
+				     const gcfg_keyword_t *keywords)
+{
+	gcfg_document_t *doc = NULL;
+	gcfg_reader_t *rd;
+	gcfg_event_t ev;
+	builder_t b;
+	uint32_t idx, off;
+	int ret;
+
+	memset(&b, 0, sizeof(b));
+	b.list[0] = keywords;
+
+	rd = gcfg_reader_create(file, keywords, GCFG_DEFAULT_MAX_DEPTH);
+	if (rd == NULL)
+		return NULL;
+
+	/* the root node, plus the reserved string offset 0 */
+	if (add_node(&b, GCFG_NODE_ROOT, &idx) == NULL ||
+	    add_string(&b, "", &off)) {
+		goto fail_oom;
+	}
+
+	while ((ret = gcfg_reader_next(rd, &ev)) == 0) {
+		if (add_event(&b, &ev))
+			goto fail_oom;
+	}
+
+	if (ret < 0)
+		goto out;
+
+	doc = finish(&b);
+	if (doc == NULL)
+		goto fail_oom;
+out:
+	gcfg_reader_destroy(rd);
+	free(b.nodes);
+	free(b.strings);
+	return doc;
+fail_oom:
+	file->report_error(file, "out of memory");
+	goto out;
+}
+
+void gcfg_document_free(gcfg_document_t *doc)
+{
+#ifndef GCFG_DISABLE_STDIO
+	if (doc->map_size > 0) {
+		gcfg_document_unmap(doc);
+		return;
+	}
+#endif
+	free(doc);
+}
+
+size_t gcfg_document_node_count(const gcfg_document_t *doc)
+{
+	return doc->node_count;
+}
+
+const gcfg_node_t *gcfg_document_node(const gcfg_document_t *doc,
+				      uint32_t index)
+{
+	return index < doc->node_count ? doc->nodes + index : NULL;
+}
+
+const char *gcfg_document_string(const gcfg_document_t *doc,
+				 uint32_t offset)
+{
+	if (offset == 0 || offset >= doc->string_size)
+		return NULL;
+
+	return (const char *)(doc->nodes + doc->node_count) + offset;
+}
+
+/* value strings are not const, but must not be modified either */
+static char *get_string(const gcfg_document_t *doc, uint32_t offset)
+{
+	return (char *)(uintptr_t)gcfg_document_string(doc, offset);
+}
+
+void gcfg_node_get_value(const gcfg_document_t *doc, const gcfg_node_t *node,
+			 gcfg_value_t *out)
+{
+	*out = node->value;
+
+	if (out->type == GCFG_VALUE_STRING) {
+		out->data.string = get_string(doc, node->strings[0]);
+	} else if (out->type == GCFG_VALUE_URI) {
+		out->data.uri.scheme = get_string(doc, node->strings[0]);
+		out->data.uri.userinfo = get_string(doc, node->strings[1]);
+		out->data.uri.host = get_string(doc, node->strings[2]);
+		out->data.uri.path = get_string(doc, node->strings[3]);
+		out->data.uri.query = get_string(doc, node->strings[4]);
+		out->data.uri.fragment = get_string(doc, node->strings[5]);
+	}
+}
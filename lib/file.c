@@ -4,7 +4,7 @@
  *
  * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
  */
-#include "gcfg.h"
+#include "internal.h"
 
 #include <stdbool.h>
 #include <stdarg.h>
@@ -14,32 +14,21 @@
 #include <stdio.h>
 #include <errno.h>
 #include <fcntl.h>
-
-#define BUFFER_SIZE (256)
-
-typedef struct {
-	gcfg_file_t base;
-
-	const char *name;
-	unsigned long linenum;
-	int fd;
-
-	size_t buffer_used;
-	size_t line_len;
-	bool eof;
-
-	char *namestr;
-	char buffer[BUFFER_SIZE];
-} gcfg_stdio_file_t;
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 static GCFG_PRINTF_FUN(2, 3) void report_error(gcfg_file_t *base,
 					       const char *msg, ...)
 {
 	gcfg_stdio_file_t *file = (gcfg_stdio_file_t *)base;
+	unsigned long linenum = file->linenum;
 	ssize_t ret;
 	va_list ap;
 
-	dprintf(STDERR_FILENO, "%s: %lu: ", file->name, file->linenum);
+	if (base->line_count > 0)
+		linenum += base->line_index + 1;
+
+	dprintf(STDERR_FILENO, "%s: %lu: ", file->name, linenum);
 
 	va_start(ap, msg);
 	vdprintf(STDERR_FILENO, msg, ap);
@@ -50,90 +39,364 @@ static GCFG_PRINTF_FUN(2, 3) void report_error(gcfg_file_t *base,
 	} while (ret < 0 && (errno == EINTR));
 }
 
-static int fetch_line(gcfg_file_t *base)
+static ssize_t read_fd(gcfg_stdio_file_t *file, char *dst, size_t size)
 {
-	gcfg_stdio_file_t *file = (gcfg_stdio_file_t *)base;
 	ssize_t ret;
-	size_t diff;
 
-	/* remove current line */
-	if (file->line_len > 0) {
-		if (file->line_len < file->buffer_used) {
-			diff = file->buffer_used - file->line_len;
+	do {
+		ret = read(file->fd, dst, size);
+	} while (ret < 0 && errno == EINTR);
 
-			memmove(file->buffer,
-				file->buffer + file->line_len,
-				diff);
+	if (ret < 0)
+		report_error((gcfg_file_t *)file, "%s", strerror(errno));
 
-			file->buffer_used -= file->line_len;
-		} else {
-			file->buffer_used = 0;
-		}
+	return ret;
+}
+
+static ssize_t read_memory(gcfg_stdio_file_t *file, char *dst, size_t size)
+{
+	size_t diff = file->source_size - file->source_offset;
+
+	if (diff > size)
+		diff = size;
 
-		file->line_len = 0;
+	memcpy(dst, file->source + file->source_offset, diff);
+	file->source_offset += diff;
+	return (ssize_t)diff;
+}
+
+static void reset_buffer(gcfg_stdio_file_t *file)
+{
+	file->used = 0;
+	file->offset = 0;
+	file->scan = 0;
+	file->eof = false;
+	file->scan_ascii = true;
+	file->have_bits = false;
+}
+
+static int seek_fd(gcfg_stdio_file_t *file, uint64_t offset)
+{
+	if (lseek(file->fd, (off_t)offset, SEEK_SET) == (off_t)-1) {
+		report_error((gcfg_file_t *)file, "%s", strerror(errno));
+		return -1;
 	}
 
-	/* fetch more data */
-	while (!file->eof && file->buffer_used < BUFFER_SIZE) {
-		diff = BUFFER_SIZE - file->buffer_used;
+	reset_buffer(file);
+	return 0;
+}
 
-		ret = read(file->fd, file->buffer + file->buffer_used, diff);
+static int seek_memory(gcfg_stdio_file_t *file, uint64_t offset)
+{
+	file->source_offset = offset < file->source_size ?
+		(size_t)offset : file->source_size;
+	reset_buffer(file);
+	return 0;
+}
 
-		if (ret < 0) {
-			if (errno == EINTR)
-				continue;
+static int seek_mmap(gcfg_stdio_file_t *file, uint64_t offset)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	size_t start;
+	void *ret;
+
+	if (offset > file->used)
+		offset = file->used;
+
+	/*
+	  Everything before the current position may have been modified in
+	  place. Map the file over it again to get the original content back.
+	*/
+	if (offset < file->offset) {
+		if (pagesize <= 0)
+			pagesize = 4096;
+
+		start = (size_t)offset - (size_t)offset % (size_t)pagesize;
+
+		ret = mmap(file->map + start, file->offset - start,
+			   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+			   file->fd, (off_t)start);
+		if (ret == MAP_FAILED) {
+			report_error((gcfg_file_t *)file, "%s",
+				     strerror(errno));
+			return -1;
+		}
+	}
 
-			report_error(base, "%s", strerror(errno));
+	file->offset = (size_t)offset;
+	file->scan = (size_t)offset;
+	file->scan_ascii = true;
+	file->have_bits = false;
+	return 0;
+}
+
+/*
+  Returns 0 on success, -1 on failure, > 0 if the read hook has no data
+  available yet.
+*/
+static int fill_buffer(gcfg_stdio_file_t *file)
+{
+	size_t diff;
+	ssize_t ret;
+#ifndef GCFG_DISABLE_ALLOC
+	char *new;
+#endif
+
+	/* move the unfinished line to the front, once per refill */
+	if (file->offset > 0) {
+		diff = file->used - file->offset;
+
+		if (diff > 0)
+			memmove(file->data, file->data + file->offset, diff);
+
+		file->used = diff;
+		file->scan -= file->offset;
+		file->offset = 0;
+		file->have_bits = false;
+	}
+
+	/* always keep one byte spare for terminating the last line */
+	if ((file->capacity - file->used) < CHUNK_SIZE / 2) {
+#ifdef GCFG_DISABLE_ALLOC
+		if (file->used + 1 >= file->capacity) {
+			report_error((gcfg_file_t *)file, "line too long");
+			return -1;
+		}
+#else
+		if (file->capacity > (SIZE_MAX / 2)) {
+			report_error((gcfg_file_t *)file, "line too long");
 			return -1;
 		}
 
-		if (ret == 0)
-			file->eof = true;
+		new = realloc(file->data, file->capacity * 2);
+		if (new == NULL) {
+			report_error((gcfg_file_t *)file, "%s",
+				     strerror(errno));
+			return -1;
+		}
 
-		file->buffer_used += (size_t)ret;
+		file->data = new;
+		file->capacity *= 2;
+#endif
 	}
 
-	if (file->buffer_used == 0)
+	ret = file->read(file, file->data + file->used,
+			 file->capacity - file->used - 1);
+
+	if (ret == GCFG_READ_AGAIN)
 		return 1;
 
-	/* isolate line */
-	for (;;) {
-		if (file->buffer[file->line_len] == '\n') {
-			file->buffer[file->line_len] = '\0';
+	if (ret < 0)
+		return -1;
 
-			if (file->buffer[file->line_len - 1] == '\r')
-				file->buffer[file->line_len - 1] = '\0';
+	if (ret == 0)
+		file->eof = true;
 
-			file->line_len += 1;
-			break;
+	file->used += (size_t)ret;
+	return 0;
+}
+
+#define BYTES(x) ((~(uint64_t)0 / 255) * (x))
+
+/*
+  Searches the next line break and on the way checks if the line consists of
+  printable ASCII characters and tabs only. Such a line is valid UTF-8 and
+  does not need to be checked again by the parser. For anything else, the
+  rest of the line is searched with memchr and left to gcfg_is_valid_utf8.
+
+  The input is classified 64 bytes at a time. A block usually holds several
+  lines, which are then found by bit scanning alone. Less than 64 bytes at
+  the end of the buffer are checked 8 at a time.
+*/
+static char *scan_line(gcfg_stdio_file_t *file)
+{
+	char *ptr = file->data + file->scan, *end = file->data + file->used;
+	uint64_t w, x, bad, before;
+	size_t i, pos;
+	int c;
+
+	while (file->scan_ascii && ptr < end) {
+		pos = (size_t)(ptr - file->data);
+
+		if (!file->have_bits || pos < file->bits_start ||
+		    pos - file->bits_start >= 64) {
+			if ((end - ptr) < 64)
+				break;
+
+			gcfg_scan_block(ptr, &file->bits);
+			file->bits_start = pos;
+			file->have_bits = true;
 		}
 
-		if (file->line_len == file->buffer_used) {
-			if (file->buffer_used == BUFFER_SIZE) {
-				report_error(base, "line too long");
-				return -1;
+		/* a '\r' is only accepted right before a '\n' */
+		bad = file->bits.other |
+			(file->bits.cr & ~(file->bits.newline >> 1));
+
+		i = pos - file->bits_start;
+		w = file->bits.newline >> i;
+		bad >>= i;
+
+		if (w != 0) {
+			before = (w & (~w + 1)) - 1;
+
+			if (bad & before) {
+				file->scan_ascii = false;
+				break;
 			}
 
-			file->buffer[file->line_len] = '\0';
+			return ptr + __builtin_ctzll(w);
+		}
+
+		if (bad != 0) {
+			file->scan_ascii = false;
 			break;
 		}
 
-		file->line_len += 1;
+		ptr += 64 - i;
 	}
 
-	file->linenum += 1;
+	while (file->scan_ascii && ptr < end) {
+		if ((end - ptr) >= 8) {
+			memcpy(&w, ptr, sizeof(w));
+
+			/* any byte >= 0x80, < 0x20 or equal to 0x7F */
+			x = w ^ BYTES(0x7F);
+			x = ((x - BYTES(1)) & ~x) | ((w - BYTES(0x20)) & ~w);
+
+			if (((x | w) & BYTES(0x80)) == 0) {
+				ptr += 8;
+				continue;
+			}
+		}
+
+		for (i = 0; i < 8 && ptr < end; ++i, ++ptr) {
+			c = *((unsigned char *)ptr);
+
+			if (c == '\n')
+				return ptr;
+
+			if (c == '\r' && (ptr + 1) < end && ptr[1] == '\n')
+				continue;
+
+			if (c >= 0x7F || (c < 0x20 && c != '\t')) {
+				file->scan_ascii = false;
+				break;
+			}
+		}
+	}
+
+	if (ptr < end)
+		ptr = memchr(ptr, '\n', (size_t)(end - ptr));
+
+	if (ptr == NULL || ptr == end)
+		return NULL;
+
+	return ptr;
+}
+
+/* Returns 0 on success, > 0 if the buffer has no complete line left. */
+static int isolate_line(gcfg_stdio_file_t *file, gcfg_line_t *out)
+{
+	char *line, *end;
+
+	end = scan_line(file);
+
+	if (end == NULL) {
+		file->scan = file->used;
+
+		if (!file->eof || file->offset == file->used)
+			return 1;
+
+		/* last line without line break */
+		end = file->data + file->used;
+	}
+
+	line = file->data + file->offset;
+	file->offset = (size_t)(end - file->data);
+
+	if (file->offset < file->used)
+		file->offset += 1;
+
+	file->scan = file->offset;
+
+	if (end > line && end[-1] == '\r')
+		--end;
+
+	*end = '\0';
+	out->data = line;
+	out->length = (size_t)(end - line);
+	out->flags = file->scan_ascii ? GCFG_LINE_VALID_UTF8 : 0;
+
+	file->scan_ascii = true;
+	return 0;
+}
+
+static int fetch_line(gcfg_file_t *base)
+{
+	gcfg_stdio_file_t *file = (gcfg_stdio_file_t *)base;
+	gcfg_line_t line;
+	int ret;
+
+	while (isolate_line(file, &line) != 0) {
+		if (file->eof)
+			return 1;
+
+		ret = fill_buffer(file);
+		if (ret != 0)
+			return ret;
+	}
+
+	file->linenum += base->line_count + 1;
+	base->line_count = 0;
+	base->buffer = line.data;
+	return 0;
+}
+
+static int fetch_lines(gcfg_file_t *base)
+{
+	gcfg_stdio_file_t *file = (gcfg_stdio_file_t *)base;
+	size_t count = 0;
+	int ret;
+
+	file->linenum += base->line_count;
+	base->line_count = 0;
+	base->line_index = 0;
+
+	while (count < BATCH_SIZE) {
+		if (isolate_line(file, file->lines + count) == 0) {
+			++count;
+			continue;
+		}
+
+		/* refilling moves the data the lines point to */
+		if (count > 0 || file->eof)
+			break;
+
+		ret = fill_buffer(file);
+		if (ret < 0)
+			return -1;
+		if (ret > 0)
+			break;
+	}
+
+	if (count == 0)
+		return 1;
+
+	base->lines = file->lines;
+	base->line_count = count;
+	base->buffer = file->lines[0].data;
 	return 0;
 }
 
 #ifdef GCFG_DISABLE_ALLOC
 static gcfg_stdio_file_t static_file;
+static char static_buffer[CHUNK_SIZE];
 static bool have_file = false;
 #endif
 
-gcfg_file_t *gcfg_file_open(const char *path)
+static gcfg_stdio_file_t *alloc_file(const char *path)
 {
 	gcfg_stdio_file_t *file;
-	gcfg_file_t *base;
 
 #ifdef GCFG_DISABLE_ALLOC
 	if (have_file) {
@@ -158,37 +421,333 @@ gcfg_file_t *gcfg_file_open(const char *path)
 
 	file->name = file->namestr;
 #endif
+	file->fd = -1;
+	file->read = read_fd;
+	file->scan_ascii = true;
+	return file;
+#ifndef GCFG_DISABLE_ALLOC
+fail:
+	dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+	free(file);
+	return NULL;
+#endif
+}
 
-	file->fd = open(path, O_RDONLY);
-	if (file->fd < 0)
-		goto fail;
+static void free_file(gcfg_stdio_file_t *file)
+{
+#ifdef GCFG_DISABLE_ALLOC
+	(void)file;
+	have_file = false;
+#else
+	free(file->namestr);
+	free(file);
+#endif
+}
+
+static gcfg_file_t *init_base(gcfg_stdio_file_t *file)
+{
+	gcfg_file_t *base = (gcfg_file_t *)file;
 
-	base = (gcfg_file_t *)file;
 	base->report_error = report_error;
 	base->fetch_line = fetch_line;
-	base->buffer = file->buffer;
+	base->fetch_lines = fetch_lines;
+	base->buffer = file->data;
 	return base;
-fail:
-	dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+}
+
+gcfg_stdio_file_t *gcfg_stdio_file_create(const char *name)
+{
+	gcfg_stdio_file_t *file;
+
+	file = alloc_file(name);
+	if (file == NULL)
+		return NULL;
+
+#ifdef GCFG_DISABLE_ALLOC
+	file->data = static_buffer;
+#else
+	file->data = malloc(CHUNK_SIZE);
+	if (file->data == NULL) {
+		dprintf(STDERR_FILENO, "%s: %s\n", name, strerror(errno));
+		free_file(file);
+		return NULL;
+	}
+#endif
+	file->capacity = CHUNK_SIZE;
+	init_base(file);
+	return file;
+}
+
 #ifndef GCFG_DISABLE_ALLOC
-	if (file != NULL) {
-		free(file->namestr);
-		free(file);
+char *gcfg_read_fd(int fd, size_t *size)
+{
+	size_t used = 0, max;
+	struct stat sb;
+	char *data, *new;
+	ssize_t ret;
+
+	if (fstat(fd, &sb) != 0)
+		return NULL;
+
+	if ((uint64_t)sb.st_size > SIZE_MAX / 2) {
+		errno = EFBIG;
+		return NULL;
 	}
+
+	/* room for the null byte, and to see the end without growing */
+	max = (size_t)sb.st_size + 2;
+
+	data = malloc(max);
+	if (data == NULL)
+		return NULL;
+
+	for (;;) {
+		if (max - used == 1) {
+			if (max > SIZE_MAX / 2) {
+				errno = EFBIG;
+				goto fail;
+			}
+
+			new = realloc(data, max * 2);
+			if (new == NULL)
+				goto fail;
+
+			data = new;
+			max *= 2;
+		}
+
+		ret = read(fd, data + used, max - used - 1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+
+		if (ret == 0)
+			break;
+
+		used += (size_t)ret;
+	}
+
+	data[used] = '\0';
+	*size = used;
+	return data;
+fail:
+	free(data);
+	return NULL;
+}
 #endif
+
+gcfg_file_t *gcfg_file_open(const char *path)
+{
+	gcfg_stdio_file_t *file;
+
+	file = gcfg_stdio_file_create(path);
+	if (file == NULL)
+		return NULL;
+
+	file->fd = open(path, O_RDONLY);
+	if (file->fd < 0) {
+		dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+		gcfg_file_close((gcfg_file_t *)file);
+		return NULL;
+	}
+
+	file->seek = seek_fd;
+	return (gcfg_file_t *)file;
+}
+
+gcfg_file_t *gcfg_file_open_mmap(const char *path)
+{
+	gcfg_stdio_file_t *file;
+	struct stat sb;
+	long pagesize;
+	void *ret;
+
+	file = alloc_file(path);
+	if (file == NULL)
+		return NULL;
+
+	file->fd = open(path, O_RDONLY);
+	if (file->fd < 0)
+		goto fail;
+
+	if (fstat(file->fd, &sb) != 0)
+		goto fail;
+
+	if (!S_ISREG(sb.st_mode)) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pagesize <= 0)
+		pagesize = 4096;
+
+	if ((uint64_t)sb.st_size >= SIZE_MAX - (size_t)pagesize) {
+		errno = EFBIG;
+		goto fail;
+	}
+
+	/*
+	  Lines are null-terminated in place, so the mapping is private and
+	  writable. An extra anonymous page is reserved behind the file, so
+	  the last line can be terminated even if the file does not end with
+	  a line break and its size is a multiple of the page size.
+	*/
+	file->used = (size_t)sb.st_size;
+	file->map_size = file->used / (size_t)pagesize + 1;
+	file->map_size *= (size_t)pagesize;
+
+	ret = mmap(NULL, file->map_size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ret == MAP_FAILED)
+		goto fail;
+
+	file->map = ret;
+
+	if (file->used > 0) {
+		ret = mmap(file->map, file->used, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_FIXED, file->fd, 0);
+		if (ret == MAP_FAILED)
+			goto fail;
+
+		posix_madvise(file->map, file->used, POSIX_MADV_SEQUENTIAL);
+	}
+
+	/*
+	  The whole file is already in the buffer. The descriptor is kept
+	  open, so modified pages can be restored after seeking backwards.
+	*/
+	file->data = file->map;
+	file->capacity = file->map_size;
+	file->eof = true;
+	file->seek = seek_mmap;
+	return init_base(file);
+fail:
+	dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+	if (file->map != NULL)
+		munmap(file->map, file->map_size);
+	if (file->fd >= 0)
+		close(file->fd);
+	free_file(file);
+	return NULL;
+}
+
+gcfg_file_t *gcfg_file_open_memory(const char *name, const char *data,
+				  size_t size)
+{
+	gcfg_stdio_file_t *file;
+
+	file = gcfg_stdio_file_create(name);
+	if (file == NULL)
+		return NULL;
+
+	file->source = data;
+	file->source_size = size;
+	file->read = read_memory;
+	file->seek = seek_memory;
+	return (gcfg_file_t *)file;
+}
+
+#if defined(GCFG_DISABLE_THREADS) || defined(GCFG_DISABLE_ALLOC)
+gcfg_file_t *gcfg_file_open_async(const char *path)
+{
+	return gcfg_file_open(path);
+}
+
+int gcfg_parse_path_parallel(const char *path, const gcfg_keyword_t *keywords,
+			     void *usr, unsigned int threads, uint32_t flags)
+{
+	gcfg_file_t *file;
+	int ret;
+
+	(void)threads; (void)flags;
+
+	file = gcfg_file_open(path);
+	if (file == NULL)
+		return -1;
+
+	ret = gcfg_parse_file(file, keywords, usr);
+	gcfg_file_close(file);
+	return ret;
+}
+#endif
+
+#ifdef GCFG_DISABLE_ALLOC
+/* without an allocator there is no decompressor state, but compressed
+   input is still recognized, rather than reported as garbled text */
+gcfg_file_t *gcfg_file_open_compressed(const char *path)
+{
+	static const uint8_t gzip_magic[2] = { 0x1F, 0x8B };
+	static const uint8_t zstd_magic[4] = { 0x28, 0xB5, 0x2F, 0xFD };
+	gcfg_stdio_file_t *file;
+	const char *format;
+	uint8_t magic[4];
+	ssize_t ret;
+
+	file = (gcfg_stdio_file_t *)gcfg_file_open(path);
+	if (file == NULL)
+		return NULL;
+
+	ret = pread(file->fd, magic, sizeof(magic), 0);
+
+	if (ret >= (ssize_t)sizeof(zstd_magic) &&
+	    memcmp(magic, zstd_magic, sizeof(zstd_magic)) == 0) {
+		format = "zstd";
+	} else if (ret >= (ssize_t)sizeof(gzip_magic) &&
+		   memcmp(magic, gzip_magic, sizeof(gzip_magic)) == 0) {
+		format = "gzip";
+	} else {
+		return (gcfg_file_t *)file;
+	}
+
+	dprintf(STDERR_FILENO, "%s: %s decompression not supported\n",
+		path, format);
+	gcfg_file_close((gcfg_file_t *)file);
 	return NULL;
 }
 
+int gcfg_file_build_index(gcfg_file_t *file)
+{
+	file->report_error(file, "line index not supported");
+	return -1;
+}
+
+int gcfg_file_seek_line(gcfg_file_t *file, unsigned long line)
+{
+	(void)line;
+	return gcfg_file_build_index(file);
+}
+
+int gcfg_file_seek_offset(gcfg_file_t *file, uint64_t offset)
+{
+	(void)offset;
+	return gcfg_file_build_index(file);
+}
+#endif
+
 void gcfg_file_close(gcfg_file_t *base)
 {
 	gcfg_stdio_file_t *file = (gcfg_stdio_file_t *)base;
 
-	close(file->fd);
+	if (file->cleanup != NULL)
+		file->cleanup(file);
 
-#ifdef GCFG_DISABLE_ALLOC
-	have_file = false;
-#else
-	free(file->namestr);
-	free(file);
+	if (file->map != NULL) {
+		munmap(file->map, file->map_size);
+	} else {
+#ifndef GCFG_DISABLE_ALLOC
+		free(file->data);
 #endif
+	}
+
+#ifndef GCFG_DISABLE_ALLOC
+	free(file->index);
+#endif
+
+	if (file->fd >= 0)
+		close(file->fd);
+
+	free_file(file);
 }
@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * file_async.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+
+/*
+  A helper thread reads ahead into two chunk buffers, while the parser works
+  on the lines already in the file buffer. Data is handed over from the
+  oldest full chunk, and as soon as a chunk is used up, the thread starts
+  reading into it again, while the parser continues with the other one.
+*/
+typedef struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* the thread reads into chunk fill, the parser takes from drain */
+	size_t fill;
+	size_t drain;
+	size_t offset;
+	bool eof;
+	bool quit;
+	int error;
+
+	struct {
+		size_t used;
+		bool ready;
+		char data[CHUNK_SIZE];
+	} chunk[2];
+} async_state_t;
+
+static void *reader_thread(void *arg)
+{
+	gcfg_stdio_file_t *file = arg;
+	async_state_t *state = file->priv;
+	char *dst;
+	ssize_t ret;
+
+	pthread_mutex_lock(&state->lock);
+
+	while (!state->quit) {
+		if (state->chunk[state->fill].ready || state->eof ||
+		    state->error != 0) {
+			pthread_cond_wait(&state->cond, &state->lock);
+			continue;
+		}
+
+		dst = state->chunk[state->fill].data;
+		pthread_mutex_unlock(&state->lock);
+
+		do {
+			ret = read(file->fd, dst, CHUNK_SIZE);
+		} while (ret < 0 && errno == EINTR);
+
+		pthread_mutex_lock(&state->lock);
+
+		if (ret < 0) {
+			state->error = errno;
+		} else if (ret == 0) {
+			state->eof = true;
+		} else {
+			state->chunk[state->fill].used = (size_t)ret;
+			state->chunk[state->fill].ready = true;
+			state->fill ^= 1;
+		}
+
+		pthread_cond_broadcast(&state->cond);
+	}
+
+	pthread_mutex_unlock(&state->lock);
+	return NULL;
+}
+
+static ssize_t read_async(gcfg_stdio_file_t *file, char *dst, size_t size)
+{
+	async_state_t *state = file->priv;
+	size_t diff, total = 0;
+	ssize_t ret;
+
+	pthread_mutex_lock(&state->lock);
+
+	while (!state->chunk[state->drain].ready && !state->eof &&
+	       state->error == 0) {
+		pthread_cond_wait(&state->cond, &state->lock);
+	}
+
+	/* take what is there, without waiting for the next read */
+	while (total < size && state->chunk[state->drain].ready) {
+		diff = state->chunk[state->drain].used - state->offset;
+		if (diff > size - total)
+			diff = size - total;
+
+		memcpy(dst + total,
+		       state->chunk[state->drain].data + state->offset, diff);
+		state->offset += diff;
+		total += diff;
+
+		if (state->offset == state->chunk[state->drain].used) {
+			state->chunk[state->drain].ready = false;
+			state->drain ^= 1;
+			state->offset = 0;
+			pthread_cond_broadcast(&state->cond);
+		}
+	}
+
+	if (total > 0) {
+		ret = (ssize_t)total;
+	} else if (state->error != 0) {
+		file->base.report_error((gcfg_file_t *)file, "%s",
+					strerror(state->error));
+		ret = -1;
+	} else {
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&state->lock);
+	return ret;
+}
+
+static void cleanup_async(gcfg_stdio_file_t *file)
+{
+	async_state_t *state = file->priv;
+
+	pthread_mutex_lock(&state->lock);
+	state->quit = true;
+	pthread_cond_broadcast(&state->cond);
+	pthread_mutex_unlock(&state->lock);
+
+	pthread_join(state->thread, NULL);
+	pthread_cond_destroy(&state->cond);
+	pthread_mutex_destroy(&state->lock);
+	free(state);
+}
+
+gcfg_file_t *gcfg_file_open_async(const char *path)
+{
+	gcfg_stdio_file_t *file;
+	async_state_t *state;
+	int ret;
+
+	file = gcfg_stdio_file_create(path);
+	if (file == NULL)
+		return NULL;
+
+	file->fd = open(path, O_RDONLY);
+	if (file->fd < 0)
+		goto fail_errno;
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		goto fail_errno;
+
+	pthread_mutex_init(&state->lock, NULL);
+	pthread_cond_init(&state->cond, NULL);
+
+	file->priv = state;
+	file->read = read_async;
+
+	ret = pthread_create(&state->thread, NULL, reader_thread, file);
+	if (ret != 0) {
+		pthread_cond_destroy(&state->cond);
+		pthread_mutex_destroy(&state->lock);
+		free(state);
+		file->priv = NULL;
+		errno = ret;
+		goto fail_errno;
+	}
+
+	file->cleanup = cleanup_async;
+	return (gcfg_file_t *)file;
+fail_errno:
+	dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+	gcfg_file_close((gcfg_file_t *)file);
+	return NULL;
+}
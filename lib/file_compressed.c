@@ -0,0 +1,334 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * file_compressed.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#ifdef GCFG_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef GCFG_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+typedef enum {
+	FORMAT_PLAIN = 0,
+	FORMAT_GZIP,
+	FORMAT_ZSTD,
+} COMPRESSOR_FORMAT;
+
+static const struct {
+	const char *name;
+	size_t size;
+	const uint8_t magic[4];
+} formats[] = {
+	[FORMAT_PLAIN] = { "plain", 0, { 0 } },
+	[FORMAT_GZIP] = { "gzip", 2, { 0x1F, 0x8B } },
+	[FORMAT_ZSTD] = { "zstd", 4, { 0x28, 0xB5, 0x2F, 0xFD } },
+};
+
+/*
+  Compressed data is read in chunks into the input buffer below and
+  decompressed directly into the line buffer of the file, so memory use
+  is bounded by the chunk size plus the longest line.
+*/
+typedef struct {
+	int format;
+	bool stream_end;
+
+#ifdef GCFG_WITH_ZLIB
+	z_stream gz;
+#endif
+#ifdef GCFG_WITH_ZSTD
+	ZSTD_DStream *zstd;
+#endif
+
+	size_t in_used;
+	size_t in_offset;
+	bool in_eof;
+
+	uint8_t in[CHUNK_SIZE];
+} compressed_state_t;
+
+static int fill_input(gcfg_stdio_file_t *file, compressed_state_t *state)
+{
+	ssize_t ret;
+
+	if (state->in_offset < state->in_used || state->in_eof)
+		return 0;
+
+	do {
+		ret = read(file->fd, state->in, sizeof(state->in));
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		file->base.report_error((gcfg_file_t *)file, "%s",
+					strerror(errno));
+		return -1;
+	}
+
+	state->in_eof = (ret == 0);
+	state->in_used = (size_t)ret;
+	state->in_offset = 0;
+	return 0;
+}
+
+static ssize_t read_plain(gcfg_stdio_file_t *file, compressed_state_t *state,
+			  char *dst, size_t size)
+{
+	if (fill_input(file, state))
+		return -1;
+
+	if (size > state->in_used - state->in_offset)
+		size = state->in_used - state->in_offset;
+
+	memcpy(dst, state->in + state->in_offset, size);
+	state->in_offset += size;
+	return (ssize_t)size;
+}
+
+#ifdef GCFG_WITH_ZLIB
+static ssize_t read_gzip(gcfg_stdio_file_t *file, compressed_state_t *state,
+			 char *dst, size_t size)
+{
+	int ret;
+
+	if (size > UINT_MAX)
+		size = UINT_MAX;
+
+	state->gz.next_out = (Bytef *)dst;
+	state->gz.avail_out = (uInt)size;
+
+	while (state->gz.avail_out == size) {
+		if (fill_input(file, state))
+			return -1;
+
+		if (state->in_offset == state->in_used) {
+			if (!state->stream_end)
+				goto fail_truncated;
+			break;
+		}
+
+		/* concatenated gzip members */
+		if (state->stream_end) {
+			if (inflateReset(&state->gz) != Z_OK)
+				goto fail_zlib;
+			state->stream_end = false;
+		}
+
+		state->gz.next_in = state->in + state->in_offset;
+		state->gz.avail_in = (uInt)(state->in_used - state->in_offset);
+
+		ret = inflate(&state->gz, Z_NO_FLUSH);
+
+		state->in_offset = state->in_used - state->gz.avail_in;
+
+		if (ret == Z_STREAM_END) {
+			state->stream_end = true;
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			goto fail_zlib;
+		}
+	}
+
+	return (ssize_t)(size - state->gz.avail_out);
+fail_truncated:
+	file->base.report_error((gcfg_file_t *)file,
+				"gzip: unexpected end of compressed data");
+	return -1;
+fail_zlib:
+	file->base.report_error((gcfg_file_t *)file, "gzip: %s",
+				state->gz.msg == NULL ? "internal error" :
+				state->gz.msg);
+	return -1;
+}
+#endif
+
+#ifdef GCFG_WITH_ZSTD
+static ssize_t read_zstd(gcfg_stdio_file_t *file, compressed_state_t *state,
+			 char *dst, size_t size)
+{
+	ZSTD_outBuffer out = { dst, size, 0 };
+	ZSTD_inBuffer in;
+	size_t ret;
+
+	while (out.pos == 0) {
+		if (fill_input(file, state))
+			return -1;
+
+		if (state->in_offset == state->in_used) {
+			if (!state->stream_end)
+				goto fail_truncated;
+			break;
+		}
+
+		in.src = state->in;
+		in.size = state->in_used;
+		in.pos = state->in_offset;
+
+		ret = ZSTD_decompressStream(state->zstd, &out, &in);
+		if (ZSTD_isError(ret))
+			goto fail_zstd;
+
+		state->in_offset = in.pos;
+		state->stream_end = (ret == 0);
+	}
+
+	return (ssize_t)out.pos;
+fail_truncated:
+	file->base.report_error((gcfg_file_t *)file,
+				"zstd: unexpected end of compressed data");
+	return -1;
+fail_zstd:
+	file->base.report_error((gcfg_file_t *)file, "zstd: %s",
+				ZSTD_getErrorName(ret));
+	return -1;
+}
+#endif
+
+static ssize_t read_compressed(gcfg_stdio_file_t *file, char *dst,
+			       size_t size)
+{
+	compressed_state_t *state = file->priv;
+
+	switch (state->format) {
+#ifdef GCFG_WITH_ZLIB
+	case FORMAT_GZIP:
+		return read_gzip(file, state, dst, size);
+#endif
+#ifdef GCFG_WITH_ZSTD
+	case FORMAT_ZSTD:
+		return read_zstd(file, state, dst, size);
+#endif
+	default:
+		break;
+	}
+
+	return read_plain(file, state, dst, size);
+}
+
+static void cleanup_compressed(gcfg_stdio_file_t *file)
+{
+	compressed_state_t *state = file->priv;
+
+#ifdef GCFG_WITH_ZLIB
+	if (state->format == FORMAT_GZIP)
+		inflateEnd(&state->gz);
+#endif
+#ifdef GCFG_WITH_ZSTD
+	if (state->format == FORMAT_ZSTD)
+		ZSTD_freeDStream(state->zstd);
+#endif
+	free(state);
+}
+
+/* Returns 0 on success, -1 on failure or -2 if not supported. */
+static int init_decompressor(compressed_state_t *state)
+{
+	switch (state->format) {
+#ifdef GCFG_WITH_ZLIB
+	case FORMAT_GZIP:
+		/* automatic gzip header detection */
+		if (inflateInit2(&state->gz, 15 + 32) != Z_OK)
+			return -1;
+		break;
+#endif
+#ifdef GCFG_WITH_ZSTD
+	case FORMAT_ZSTD:
+		state->zstd = ZSTD_createDStream();
+		if (state->zstd == NULL)
+			return -1;
+		if (ZSTD_isError(ZSTD_initDStream(state->zstd))) {
+			ZSTD_freeDStream(state->zstd);
+			return -1;
+		}
+		break;
+#endif
+	case FORMAT_PLAIN:
+		break;
+	default:
+		return -2;
+	}
+
+	return 0;
+}
+
+gcfg_file_t *gcfg_file_open_compressed(const char *path)
+{
+	compressed_state_t *state;
+	gcfg_stdio_file_t *file;
+	ssize_t ret;
+	size_t i;
+	int err;
+
+	file = gcfg_stdio_file_create(path);
+	if (file == NULL)
+		return NULL;
+
+	file->fd = open(path, O_RDONLY);
+	if (file->fd < 0)
+		goto fail_errno;
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		goto fail_errno;
+
+	file->priv = state;
+
+	/* the input buffer is large enough for the longest magic value */
+	while (state->in_used < sizeof(formats[FORMAT_ZSTD].magic)) {
+		do {
+			ret = read(file->fd, state->in + state->in_used,
+				   sizeof(state->in) - state->in_used);
+		} while (ret < 0 && errno == EINTR);
+
+		if (ret < 0)
+			goto fail_errno;
+
+		if (ret == 0) {
+			state->in_eof = true;
+			break;
+		}
+
+		state->in_used += (size_t)ret;
+	}
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+		if (formats[i].size == 0 || formats[i].size > state->in_used)
+			continue;
+
+		if (memcmp(state->in, formats[i].magic, formats[i].size) == 0) {
+			state->format = (int)i;
+			break;
+		}
+	}
+
+	err = init_decompressor(state);
+	if (err != 0) {
+		dprintf(STDERR_FILENO, "%s: %s decompression %s\n", path,
+			formats[state->format].name,
+			err == -2 ? "not supported" : "failed to initialize");
+		goto fail;
+	}
+
+	file->read = read_compressed;
+	file->cleanup = cleanup_compressed;
+	return (gcfg_file_t *)file;
+fail_errno:
+	dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+fail:
+	free(file->priv);
+	file->priv = NULL;
+	gcfg_file_close((gcfg_file_t *)file);
+	return NULL;
+}
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * file_index.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+typedef struct {
+	uint64_t *offsets;
+	size_t count;
+	size_t max;
+} line_index_t;
+
+static int add_line(line_index_t *idx, uint64_t offset)
+{
+	uint64_t *new;
+	size_t size;
+
+	if (idx->count == idx->max) {
+		size = idx->max ? idx->max * 2 : 256;
+
+		new = realloc(idx->offsets, size * sizeof(new[0]));
+		if (new == NULL)
+			return -1;
+
+		idx->offsets = new;
+		idx->max = size;
+	}
+
+	idx->offsets[idx->count++] = offset;
+	return 0;
+}
+
+/* records the line that starts after each line break in a chunk */
+static int index_chunk(line_index_t *idx, const char *data, size_t size,
+		       uint64_t base)
+{
+	const char *ptr = data, *end = data + size;
+
+	while ((ptr = memchr(ptr, '\n', (size_t)(end - ptr))) != NULL) {
+		++ptr;
+
+		if (add_line(idx, base + (uint64_t)(ptr - data)))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int seek_to(gcfg_stdio_file_t *file, uint64_t offset,
+		   unsigned long linenum)
+{
+	if (file->seek(file, offset))
+		return -1;
+
+	file->linenum = linenum;
+	file->base.line_count = 0;
+	file->base.line_index = 0;
+	return 0;
+}
+
+int gcfg_file_build_index(gcfg_file_t *base)
+{
+	gcfg_stdio_file_t *file = (gcfg_stdio_file_t *)base;
+	line_index_t idx = { NULL, 0, 0 };
+	uint64_t size = 0;
+	ssize_t ret;
+
+	if (file->seek == NULL) {
+		base->report_error(base, "random access not supported");
+		return -1;
+	}
+
+	if (add_line(&idx, 0))
+		goto fail_errno;
+
+	/* also restores mapped data that was modified in place */
+	if (file->seek(file, 0))
+		goto fail;
+
+	if (file->map != NULL) {
+		size = file->used;
+
+		if (index_chunk(&idx, file->map, file->used, 0))
+			goto fail_errno;
+	} else {
+		for (;;) {
+			ret = file->read(file, file->data, file->capacity - 1);
+			if (ret < 0)
+				goto fail;
+			if (ret == 0)
+				break;
+
+			if (index_chunk(&idx, file->data, (size_t)ret, size))
+				goto fail_errno;
+
+			size += (uint64_t)ret;
+		}
+	}
+
+	/* a line break at the very end does not start another line */
+	if (idx.offsets[idx.count - 1] == size)
+		idx.count -= 1;
+
+	free(file->index);
+	file->index = idx.offsets;
+	file->index_count = idx.count;
+	file->index_size = size;
+	return seek_to(file, 0, 0);
+fail_errno:
+	base->report_error(base, "building line index: %s", strerror(errno));
+fail:
+	free(idx.offsets);
+	return -1;
+}
+
+int gcfg_file_seek_line(gcfg_file_t *base, unsigned long line)
+{
+	gcfg_stdio_file_t *file = (gcfg_stdio_file_t *)base;
+
+	if (file->index == NULL) {
+		base->report_error(base, "no line index");
+		return -1;
+	}
+
+	if (line == 0 || line > file->index_count) {
+		base->report_error(base, "line %lu out of range", line);
+		return -1;
+	}
+
+	return seek_to(file, file->index[line - 1], line - 1);
+}
+
+int gcfg_file_seek_offset(gcfg_file_t *base, uint64_t offset)
+{
+	gcfg_stdio_file_t *file = (gcfg_stdio_file_t *)base;
+	size_t lo, hi, mid;
+
+	if (file->index == NULL) {
+		base->report_error(base, "no line index");
+		return -1;
+	}
+
+	if (offset >= file->index_size) {
+		base->report_error(base, "seek offset out of range");
+		return -1;
+	}
+
+	/* find the last line starting at or before the offset */
+	lo = 0;
+	hi = file->index_count;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+
+		if (file->index[mid] <= offset) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return seek_to(file, file->index[lo], lo);
+}
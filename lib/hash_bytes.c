@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * hash_bytes.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <string.h>
+
+uint64_t gcfg_hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *ptr = data;
+	uint64_t w;
+
+	/* mixes in 8 bytes at a time, the tail byte by byte */
+	while (size >= sizeof(w)) {
+		memcpy(&w, ptr, sizeof(w));
+		hash = (hash ^ w) * 0x100000001B3UL;
+		hash ^= hash >> 29;
+		ptr += sizeof(w);
+		size -= sizeof(w);
+	}
+
+	while (size--)
+		hash = (hash ^ *(ptr++)) * 0x100000001B3UL;
+
+	return hash;
+}
@@ -0,0 +1,610 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * include.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <sys/stat.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+
+/* marks an include directive among the events of a file */
+#define INCLUDE_DIRECTIVE (0)
+
+/* the file currently parsed is not recorded */
+#define NO_ENTRY ((size_t)-1)
+
+/* An event of a file, with its strings kept in the pool of the entry */
+typedef struct {
+	/* A GCFG_EVENT_TYPE or INCLUDE_DIRECTIVE */
+	int type;
+	const gcfg_keyword_t *keyword;
+
+	/* index of the argument in the store, for BEGIN_BLOCK and VALUE */
+	size_t value;
+
+	/* pool offset of the line or of the include pattern, 0 if NULL */
+	size_t line;
+
+	unsigned long linenum;
+} include_event_t;
+
+/*
+  Every file that is part of the configuration has an entry, identified by
+  its inode, which records the path it was included through for the watcher
+  and detects cycles. It also keeps the events the file produced when it
+  was last parsed. As long as its size and modification time stay the same,
+  including the file again replays them through the keyword callbacks,
+  instead of reading and parsing the file.
+*/
+typedef struct {
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	off_t size;
+	unsigned int generation;
+
+	/* offset of the path it was last included through in the name pool */
+	size_t path;
+
+	/* currently being parsed, i.e. including it again is a cycle */
+	bool active;
+
+	/*
+	  The events, valid if complete is set, for the keyword list of the
+	  block the file was included in. Files that cannot be replayed, i.e.
+	  with deferred blocks, or whose events did not fit into memory are
+	  marked broken and parsed every time.
+	*/
+	const gcfg_keyword_t *list;
+	include_event_t *events;
+	size_t count;
+	size_t max;
+	gcfg_batch_t store;
+	bool complete;
+	bool broken;
+} include_entry_t;
+
+struct gcfg_include_cache_t {
+	include_entry_t *entries;
+	size_t count;
+	size_t max;
+
+	unsigned int generation;
+
+	/* paths and wildcard patterns used by the last parse */
+	char *names;
+	size_t names_used;
+	size_t names_max;
+
+	/* offsets of the wildcard patterns in the name pool */
+	size_t *patterns;
+	size_t pattern_count;
+	size_t pattern_max;
+};
+
+typedef struct {
+	gcfg_parse_ctx_t base;
+
+	gcfg_include_cache_t *cache;
+
+	/* path of the file currently parsed, relative includes start here */
+	const char *path;
+
+	/* entry of the file whose events are recorded, or NO_ENTRY */
+	size_t recording;
+} include_ctx_t;
+
+/* Stands in for a file whose events are replayed, for error messages */
+typedef struct {
+	gcfg_file_t base;
+	const char *path;
+	unsigned long linenum;
+	char empty[1];
+} replay_file_t;
+
+static GCFG_PRINTF_FUN(2, 3) void replay_error(gcfg_file_t *base,
+					       const char *msg, ...)
+{
+	replay_file_t *file = (replay_file_t *)base;
+	va_list ap;
+
+	dprintf(STDERR_FILENO, "%s: %lu: ", file->path, file->linenum);
+
+	va_start(ap, msg);
+	vdprintf(STDERR_FILENO, msg, ap);
+	va_end(ap);
+
+	dprintf(STDERR_FILENO, "\n");
+}
+
+static int replay_fetch(gcfg_file_t *base)
+{
+	(void)base;
+	return 1;
+}
+
+static void report(gcfg_file_t *file, const char *path, const char *msg)
+{
+	if (file != NULL) {
+		file->report_error(file, "%s: %s", path, msg);
+	} else {
+		dprintf(STDERR_FILENO, "%s: %s\n", path, msg);
+	}
+}
+
+static int add_name(gcfg_include_cache_t *cache, const char *name,
+		    size_t *out)
+{
+	size_t len = strlen(name) + 1, size;
+	char *new;
+
+	if (cache->names_max - cache->names_used < len) {
+		size = cache->names_max ? cache->names_max : 1024;
+		while (size - cache->names_used < len)
+			size *= 2;
+
+		new = realloc(cache->names, size);
+		if (new == NULL)
+			return -1;
+
+		cache->names = new;
+		cache->names_max = size;
+	}
+
+	memcpy(cache->names + cache->names_used, name, len);
+	*out = cache->names_used;
+	cache->names_used += len;
+	return 0;
+}
+
+static int add_pattern(gcfg_include_cache_t *cache, const char *pattern)
+{
+	size_t i, size, *new;
+
+	for (i = 0; i < cache->pattern_count; ++i) {
+		if (strcmp(cache->names + cache->patterns[i], pattern) == 0)
+			return 0;
+	}
+
+	if (cache->pattern_count == cache->pattern_max) {
+		size = cache->pattern_max ? cache->pattern_max * 2 : 8;
+		new = realloc(cache->patterns, size * sizeof(new[0]));
+		if (new == NULL)
+			return -1;
+
+		cache->patterns = new;
+		cache->pattern_max = size;
+	}
+
+	if (add_name(cache, pattern, cache->patterns + cache->pattern_count))
+		return -1;
+
+	cache->pattern_count += 1;
+	return 0;
+}
+
+static include_entry_t *find_entry(gcfg_include_cache_t *cache,
+				   const struct stat *sb)
+{
+	size_t i;
+
+	for (i = 0; i < cache->count; ++i) {
+		if (cache->entries[i].dev == sb->st_dev &&
+		    cache->entries[i].ino == sb->st_ino) {
+			return cache->entries + i;
+		}
+	}
+
+	return NULL;
+}
+
+static int get_entry(gcfg_include_cache_t *cache, const char *path,
+		     const struct stat *sb, size_t *out)
+{
+	include_entry_t *ent = find_entry(cache, sb);
+	size_t size;
+
+	if (ent == NULL) {
+		if (cache->count == cache->max) {
+			size = cache->max ? cache->max * 2 : 16;
+			ent = realloc(cache->entries, size * sizeof(ent[0]));
+			if (ent == NULL)
+				return -1;
+
+			cache->entries = ent;
+			cache->max = size;
+		}
+
+		ent = cache->entries + cache->count++;
+		memset(ent, 0, sizeof(*ent));
+		ent->dev = sb->st_dev;
+		ent->ino = sb->st_ino;
+	}
+
+	if (add_name(cache, path, &ent->path))
+		return -1;
+
+	ent->generation = cache->generation;
+	*out = (size_t)(ent - cache->entries);
+	return 0;
+}
+
+static void free_entry(include_entry_t *ent)
+{
+	free(ent->events);
+	free(ent->store.values);
+	free(ent->store.offsets);
+	free(ent->store.strings);
+}
+
+static const gcfg_keyword_t *current_list(const gcfg_parse_ctx_t *ctx)
+{
+	if (ctx->depth == 0)
+		return ctx->keywords;
+
+	return ctx->stack[ctx->depth - 1].keyword->children;
+}
+
+static bool is_unchanged(const include_entry_t *ent, const struct stat *sb,
+			 const gcfg_keyword_t *list)
+{
+	return ent->complete && ent->list == list &&
+		ent->size == sb->st_size &&
+		ent->mtime.tv_sec == sb->st_mtim.tv_sec &&
+		ent->mtime.tv_nsec == sb->st_mtim.tv_nsec;
+}
+
+static void reset_events(include_entry_t *ent, const struct stat *sb,
+			 const gcfg_keyword_t *list)
+{
+	ent->mtime = sb->st_mtim;
+	ent->size = sb->st_size;
+	ent->list = list;
+	ent->count = 0;
+	ent->store.count = 0;
+	ent->store.used = 0;
+	ent->complete = false;
+	ent->broken = false;
+}
+
+static void record(include_ctx_t *ctx, int type, const gcfg_keyword_t *kwd,
+		   const gcfg_value_t *value, const char *line)
+{
+	include_entry_t *ent;
+	include_event_t *ev;
+	size_t size;
+
+	if (ctx->recording == NO_ENTRY)
+		return;
+
+	ent = ctx->cache->entries + ctx->recording;
+	if (ent->broken)
+		return;
+
+	if (ent->count == ent->max) {
+		size = ent->max ? ent->max * 2 : 64;
+		ev = realloc(ent->events, size * sizeof(ev[0]));
+		if (ev == NULL)
+			goto fail;
+
+		ent->events = ev;
+		ent->max = size;
+	}
+
+	ev = ent->events + ent->count;
+	ev->type = type;
+	ev->keyword = kwd;
+	ev->value = ent->store.count;
+	ev->linenum = ctx->base.linenum;
+
+	if (value != NULL && gcfg_batch_store(&ent->store, value))
+		goto fail;
+
+	if (gcfg_batch_store_string(&ent->store, line, &ev->line))
+		goto fail;
+
+	ent->count += 1;
+	return;
+fail:
+	/* not an error, the file is simply parsed again next time */
+	ent->broken = true;
+}
+
+static void record_event(gcfg_parse_ctx_t *base, const gcfg_event_t *ev)
+{
+	include_ctx_t *ctx = (include_ctx_t *)base;
+	const gcfg_keyword_t *kwd = ev->keyword;
+	bool has_value;
+
+	/* the body of a deferred block is skipped, it cannot be replayed */
+	if (ev->type == GCFG_EVENT_BEGIN_BLOCK &&
+	    (kwd->flags & GCFG_KEYWORD_DEFERRED) &&
+	    kwd->handle_listing == NULL && !base->no_defer &&
+	    ctx->recording != NO_ENTRY) {
+		ctx->cache->entries[ctx->recording].broken = true;
+	}
+
+	has_value = ev->type == GCFG_EVENT_BEGIN_BLOCK ||
+		ev->type == GCFG_EVENT_VALUE;
+
+	record(ctx, ev->type, kwd, has_value ? &ev->value : NULL, ev->line);
+}
+
+static int include_pattern(gcfg_parse_ctx_t *base, gcfg_file_t *file,
+			   const char *pattern);
+
+static int replay(include_ctx_t *ctx, size_t idx, const char *path)
+{
+	const include_entry_t *ent;
+	const include_event_t *item;
+	replay_file_t file;
+	gcfg_event_t ev;
+	size_t i;
+	int ret;
+
+	memset(&file, 0, sizeof(file));
+	file.base.report_error = replay_error;
+	file.base.fetch_line = replay_fetch;
+	file.base.buffer = file.empty;
+	file.path = path;
+
+	/* nested includes can move the entries around, use the index */
+	for (i = 0; i < ctx->cache->entries[idx].count; ++i) {
+		ent = ctx->cache->entries + idx;
+		item = ent->events + i;
+
+		file.linenum = item->linenum;
+
+		if (item->type == INCLUDE_DIRECTIVE) {
+			ret = include_pattern(&ctx->base, &file.base,
+					      ent->store.strings + item->line);
+			if (ret != 0)
+				return ret;
+			continue;
+		}
+
+		memset(&ev, 0, sizeof(ev));
+		ev.type = item->type;
+		ev.keyword = item->keyword;
+		ev.linenum = item->linenum;
+
+		if (item->type == GCFG_EVENT_BEGIN_BLOCK ||
+		    item->type == GCFG_EVENT_VALUE) {
+			ev.value = ent->store.values[item->value];
+		}
+
+		if (item->line != 0)
+			ev.line = ent->store.strings + item->line;
+
+		ret = gcfg_apply_event(&file.base, &ctx->base, &ev);
+		if (ret != 0)
+			return ret;
+	}
+
+	return gcfg_batch_flush(&file.base, &ctx->base);
+}
+
+static int parse(include_ctx_t *ctx, size_t idx, const char *path)
+{
+	include_entry_t *ent;
+	gcfg_file_t *inc;
+	int ret;
+
+	inc = gcfg_file_open(path);
+	if (inc == NULL)
+		return -1;
+
+	ctx->recording = idx;
+	ret = gcfg_parse_fragment(inc, &ctx->base);
+	gcfg_file_close(inc);
+
+	ent = ctx->cache->entries + idx;
+	ent->complete = ret == 0 && !ent->broken;
+
+	if (ent->complete)
+		gcfg_batch_resolve(&ent->store);
+
+	return ret;
+}
+
+static int include_path(include_ctx_t *ctx, gcfg_file_t *file,
+			const char *path)
+{
+	const gcfg_keyword_t *list = current_list(&ctx->base);
+	const char *prev_path;
+	unsigned long linenum;
+	include_entry_t *ent;
+	size_t idx, prev;
+	struct stat sb;
+	int ret;
+
+	if (stat(path, &sb) != 0)
+		goto fail_errno;
+
+	if (!S_ISREG(sb.st_mode)) {
+		errno = EINVAL;
+		goto fail_errno;
+	}
+
+	if (get_entry(ctx->cache, path, &sb, &idx))
+		goto fail_errno;
+
+	ent = ctx->cache->entries + idx;
+
+	if (ent->active) {
+		report(file, path, "include cycle detected");
+		return -1;
+	}
+
+	prev_path = ctx->path;
+	prev = ctx->recording;
+	linenum = ctx->base.linenum;
+
+	ctx->path = path;
+	ctx->recording = NO_ENTRY;
+	ctx->base.linenum = 0;
+	ent->active = true;
+
+	if (is_unchanged(ent, &sb, list)) {
+		ret = replay(ctx, idx, path);
+	} else {
+		reset_events(ent, &sb, list);
+		ret = parse(ctx, idx, path);
+	}
+
+	ctx->cache->entries[idx].active = false;
+	ctx->path = prev_path;
+	ctx->recording = prev;
+	ctx->base.linenum = linenum;
+	return ret;
+fail_errno:
+	report(file, path, strerror(errno));
+	return -1;
+}
+
+static int include_pattern(gcfg_parse_ctx_t *base, gcfg_file_t *file,
+			   const char *pattern)
+{
+	include_ctx_t *ctx = (include_ctx_t *)base;
+	const char *slash;
+	char *path = NULL;
+	size_t i, len;
+	glob_t gl;
+	int ret;
+
+	/* replayed relative to the path of the including file, as well */
+	record(ctx, INCLUDE_DIRECTIVE, NULL, NULL, pattern);
+
+	/* relative to the directory of the including file */
+	slash = strrchr(ctx->path, '/');
+
+	if (pattern[0] != '/' && slash != NULL) {
+		len = (size_t)(slash - ctx->path) + 1;
+
+		path = malloc(len + strlen(pattern) + 1);
+		if (path == NULL) {
+			report(file, pattern, strerror(errno));
+			return -1;
+		}
+
+		memcpy(path, ctx->path, len);
+		strcpy(path + len, pattern);
+		pattern = path;
+	}
+
+	if (strpbrk(pattern, "*?[") == NULL) {
+		ret = include_path(ctx, file, pattern);
+		free(path);
+		return ret;
+	}
+
+	if (add_pattern(ctx->cache, pattern)) {
+		report(file, pattern, strerror(errno));
+		free(path);
+		return -1;
+	}
+
+	ret = glob(pattern, 0, NULL, &gl);
+
+	if (ret == GLOB_NOMATCH) {
+		free(path);
+		return 0;
+	}
+
+	if (ret != 0) {
+		report(file, pattern, ret == GLOB_NOSPACE ? "out of memory" :
+		       "read error");
+		free(path);
+		return -1;
+	}
+
+	for (i = 0; i < gl.gl_pathc; ++i) {
+		ret = include_path(ctx, file, gl.gl_pathv[i]);
+		if (ret != 0)
+			break;
+	}
+
+	globfree(&gl);
+	free(path);
+	return ret;
+}
+
+gcfg_include_cache_t *gcfg_include_cache_create(void)
+{
+	return calloc(1, sizeof(gcfg_include_cache_t));
+}
+
+void gcfg_include_cache_destroy(gcfg_include_cache_t *cache)
+{
+	size_t i;
+
+	for (i = 0; i < cache->count; ++i)
+		free_entry(cache->entries + i);
+
+	free(cache->patterns);
+	free(cache->names);
+	free(cache->entries);
+	free(cache);
+}
+
+const char *gcfg_include_cache_path(const gcfg_include_cache_t *cache,
+				    size_t index, bool *pattern)
+{
+	*pattern = index >= cache->count;
+
+	if (index < cache->count)
+		return cache->names + cache->entries[index].path;
+
+	index -= cache->count;
+	if (index >= cache->pattern_count)
+		return NULL;
+
+	return cache->names + cache->patterns[index];
+}
+
+int gcfg_parse_path(const char *path, const gcfg_keyword_t *keywords,
+		    void *usr, gcfg_include_cache_t *cache)
+{
+	gcfg_block_t stack[GCFG_DEFAULT_MAX_DEPTH];
+	include_ctx_t ctx;
+	size_t i, j;
+	int ret;
+
+	memset(&ctx, 0, sizeof(ctx));
+	gcfg_parse_ctx_init(&ctx.base, keywords, usr, stack,
+			    GCFG_DEFAULT_MAX_DEPTH);
+	ctx.base.include = include_pattern;
+	ctx.base.record = record_event;
+	ctx.cache = cache;
+	ctx.path = path;
+	ctx.recording = NO_ENTRY;
+
+	cache->generation += 1;
+	cache->names_used = 0;
+	cache->pattern_count = 0;
+
+	ret = include_path(&ctx, NULL, path);
+	gcfg_parse_ctx_cleanup(&ctx.base);
+
+	/* drop files that are no longer part of the configuration */
+	for (i = 0, j = 0; i < cache->count; ++i) {
+		if (cache->entries[i].generation != cache->generation) {
+			free_entry(cache->entries + i);
+			continue;
+		}
+
+		cache->entries[j++] = cache->entries[i];
+	}
+
+	cache->count = j;
+	return ret;
+}
@@ -0,0 +1,453 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * internal.h
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef INTERNAL_H
+#define INTERNAL_H
+
+#include "gcfg.h"
+
+#include <sys/types.h>
+
+/* initial buffer size and minimum amount of data requested per read() */
+#define CHUNK_SIZE (65536)
+
+/* maximum number of lines handed out per fetch_lines call */
+#define BATCH_SIZE (128)
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GCFG_HAVE_X86_SIMD
+#endif
+
+/* returned by the read hook of a stdio file if no data is available yet */
+#define GCFG_READ_AGAIN (-2)
+
+typedef struct gcfg_stdio_file_t gcfg_stdio_file_t;
+
+/* Classification of a block of 64 bytes, bit i stands for byte i */
+typedef struct {
+	uint64_t newline;
+	uint64_t cr;
+
+	/* anything but printable ASCII characters, tabs and line breaks */
+	uint64_t other;
+} gcfg_block_bits_t;
+
+struct gcfg_stdio_file_t {
+	gcfg_file_t base;
+
+	const char *name;
+	unsigned long linenum;
+	int fd;
+
+	/*
+	  Lines are isolated in place. Data before `offset` has already been
+	  handed out, data between `scan` and `used` has not been searched
+	  for a line break yet.
+	*/
+	char *data;
+	size_t capacity;
+	size_t used;
+	size_t offset;
+	size_t scan;
+	bool eof;
+
+	/* data between offset and scan is printable ASCII */
+	bool scan_ascii;
+
+	/*
+	  If have_bits is set, bits classifies the 64 bytes starting at
+	  bits_start. Lines in the same block are split without looking at
+	  the data again.
+	*/
+	bool have_bits;
+	size_t bits_start;
+	gcfg_block_bits_t bits;
+
+	/*
+	  Fills the buffer. Returns the number of bytes read, 0 on end-of-file
+	  or -1 on failure, after reporting the error. Defaults to read() on
+	  fd. Returns GCFG_READ_AGAIN if more input may arrive later, in which
+	  case fetching lines stops at the last complete one.
+	*/
+	ssize_t (*read)(gcfg_stdio_file_t *file, char *dst, size_t size);
+
+	/*
+	  Optional, discards the buffered data and continues reading the
+	  input at a byte offset. Returns 0 on success, -1 on failure after
+	  reporting the error. Only set if random access is supported.
+	*/
+	int (*seek)(gcfg_stdio_file_t *file, uint64_t offset);
+
+	/* Optional, releases implementation specific state in priv */
+	void (*cleanup)(gcfg_stdio_file_t *file);
+
+	void *priv;
+
+	/* set if data points to a memory mapping */
+	char *map;
+	size_t map_size;
+
+	/* set for in-memory files, the caller owns the data */
+	const char *source;
+	size_t source_size;
+	size_t source_offset;
+
+	/* start offsets of all lines and input size, see file_index.c */
+	uint64_t *index;
+	size_t index_count;
+	uint64_t index_size;
+
+	char *namestr;
+	gcfg_line_t lines[BATCH_SIZE];
+};
+
+typedef struct gcfg_parse_ctx_t gcfg_parse_ctx_t;
+
+/*
+  Values of a keyword with GCFG_KEYWORD_BATCH collected so far. Their
+  strings are copied into a pool and stored as offsets into it, 6 per value
+  as for a URI, 0 standing for NULL. The pointers are only filled in when
+  the batch is delivered, since the pool may move while it grows.
+*/
+typedef struct {
+	const gcfg_keyword_t *keyword;
+	void *parent;
+
+	gcfg_value_t *values;
+	size_t *offsets;
+	size_t count;
+	size_t max;
+
+	char *strings;
+	size_t used;
+	size_t size;
+} gcfg_batch_t;
+
+typedef struct gcfg_keyword_index_t {
+	struct gcfg_keyword_index_t *next;
+
+	const gcfg_keyword_t *list;
+	size_t count;
+
+	/*
+	  For each keyword in list, the index of its children, once a block
+	  of it has been opened. Stored in the same allocation as the index.
+	*/
+	const struct gcfg_keyword_index_t **children;
+
+	/*
+	  Open addressing hash table over the keyword names, holding the
+	  index into list plus one, or 0 for empty slots. If mask is 0, the
+	  list is searched linearly instead.
+	*/
+	uint32_t mask;
+	uint32_t slots[];
+} gcfg_keyword_index_t;
+
+struct gcfg_parse_ctx_t {
+	/*
+	  Optional, can be NULL. Handles an include directive found in file,
+	  parsing the files that match the pattern into the current block.
+	  Returns 0 on success, -1 on failure after reporting the error.
+	*/
+	int (*include)(gcfg_parse_ctx_t *ctx, gcfg_file_t *file,
+		       const char *pattern);
+
+	/*
+	  Optional, can be NULL. Called by gcfg_parse_events with every event
+	  before it is applied, so include.c can keep the events of a file.
+	*/
+	void (*record)(gcfg_parse_ctx_t *ctx, const gcfg_event_t *ev);
+
+	/* keywords and object for declarations outside of any block */
+	const gcfg_keyword_t *keywords;
+	void *object;
+
+	/*
+	  Currently open blocks. The file being parsed started at depth
+	  base, so it may not close blocks below that.
+	*/
+	gcfg_block_t *stack;
+	size_t max_depth;
+	size_t depth;
+	size_t base;
+	bool own_stack;
+
+	/* keyword lists encountered so far, built on first use */
+	gcfg_keyword_index_t *indices;
+
+	/* set once building an index failed, so it is not tried again */
+	bool no_index;
+
+	/*
+	  Index of the keyword list of the current block and of the list
+	  outside of any block. Each open block keeps the index of its
+	  list, so closing it does not have to look it up again.
+	*/
+	const gcfg_keyword_index_t *index;
+	const gcfg_keyword_index_t *root_index;
+
+	/* number of lines fetched through gcfg_next_event */
+	unsigned long linenum;
+
+	/*
+	  Set while the input is fed in piece by piece. Running out of lines
+	  then leaves open blocks open, rather than being an error.
+	*/
+	bool incomplete;
+
+	/* set once reading ran into the end of the input */
+	bool eof;
+
+	/*
+	  Parse the bodies of deferred blocks like any other. Set for input
+	  fed in piece by piece, where a body may not have arrived yet and
+	  there is no line index to find it again.
+	*/
+	bool no_defer;
+
+	/* skip unknown keywords along with their blocks, GCFG_PARSE_TOLERANT */
+	bool tolerant;
+
+	/*
+	  Memory for keyword indices set by gcfg_parse_ctx_init_arena, in
+	  units of arena[0]. If set, indices are not allocated.
+	*/
+	uintptr_t *arena;
+	size_t arena_size;
+	size_t arena_used;
+
+	gcfg_batch_t batch;
+
+	/*
+	  Set while collecting diagnostics, see parse_recover.c. The parser
+	  then records in opens_block whether the current line opens a block,
+	  before parsing modifies it.
+	*/
+	bool recover;
+	bool opens_block;
+
+	/*
+	  A GCFG_DIAG_CODE describing errors reported by the current step, or
+	  0 if reading the input failed. The column of the offending token is
+	  counted from 1, 0 if the error concerns the line as a whole.
+	*/
+	int error;
+	unsigned long column;
+};
+
+/*
+  Initializes a parse context. If stack is NULL, a stack for max_depth
+  blocks is allocated. Returns -1 if that fails.
+*/
+int gcfg_parse_ctx_init(gcfg_parse_ctx_t *ctx, const gcfg_keyword_t *keywords,
+			void *usr, gcfg_block_t *stack, size_t max_depth);
+
+/*
+  Same as gcfg_parse_ctx_init with a caller provided stack, but keyword
+  indices are built in the size words at arena instead of being allocated.
+  Lists that do not fit are searched linearly.
+*/
+void gcfg_parse_ctx_init_arena(gcfg_parse_ctx_t *ctx,
+			       const gcfg_keyword_t *keywords, void *usr,
+			       gcfg_block_t *stack, size_t max_depth,
+			       uintptr_t *arena, size_t size);
+
+/*
+  Parses a file into the current block of a context, handling include
+  directives through its include hook. Unless it fails, the file must
+  close all blocks it opens.
+*/
+int gcfg_parse_fragment(gcfg_file_t *file, gcfg_parse_ctx_t *ctx);
+
+/*
+  Same as gcfg_parse_fragment, but continues with the blocks that are
+  currently open, which the file may close.
+*/
+int gcfg_parse_events(gcfg_file_t *file, gcfg_parse_ctx_t *ctx);
+
+/*
+  Same as gcfg_parse_file, for a piece of a larger input that starts after
+  the given number of lines, so line numbers handed to the callbacks count
+  from the start of the whole input.
+*/
+int gcfg_parse_file_from(gcfg_file_t *file, const gcfg_keyword_t *keywords,
+			 void *usr, unsigned long linenum);
+
+/* Releases the stack and keyword indices held by a parse context. */
+void gcfg_parse_ctx_cleanup(gcfg_parse_ctx_t *ctx);
+
+/*
+  Reads lines from a file until one produces an event, skipping blank
+  lines and processing include directives. The event is only checked
+  against the context, the caller has to open or close blocks through
+  gcfg_push_block and gcfg_pop_block. Returns 0 on success, > 0 at the
+  end of the file, < 0 on failure.
+*/
+int gcfg_next_event(gcfg_file_t *file, gcfg_parse_ctx_t *ctx,
+		    gcfg_event_t *ev);
+
+/*
+  Delivers an event to the keyword callbacks, opening or closing blocks as
+  needed, except that the body of a deferred block is skipped right away.
+  Returns 0 on success, -1 on failure after reporting the error. If a
+  BEGIN_BLOCK event fails, the block is not opened. If the last line of a
+  listing is malformed, the block is closed without being finalized.
+*/
+int gcfg_apply_event(gcfg_file_t *file, gcfg_parse_ctx_t *ctx,
+		     const gcfg_event_t *ev);
+
+/*
+  Skips the lines of a block, up to and including the matching '}', after
+  the line opening it failed to parse or if the block is deferred. Only
+  braces are counted, the lines are not parsed otherwise and not checked for
+  valid UTF-8. Returns 0 on success, -1 on failure after reporting the
+  error.
+*/
+int gcfg_skip_block(gcfg_file_t *file, gcfg_parse_ctx_t *ctx);
+
+/*
+  Adds a value of a keyword with GCFG_KEYWORD_BATCH to the batch of the
+  context. The batch must be empty or belong to the same keyword and block.
+  Returns 0 on success, -1 on failure after reporting the error.
+*/
+int gcfg_batch_add(gcfg_file_t *file, gcfg_parse_ctx_t *ctx,
+		   const gcfg_keyword_t *kwd, const gcfg_value_t *value);
+
+/*
+  Hands the values collected so far to the keyword, if any, and empties
+  the batch. Returns 0 on success, -1 on failure.
+*/
+int gcfg_batch_flush(gcfg_file_t *file, gcfg_parse_ctx_t *ctx);
+
+/* Releases the memory held by the batch of a context. */
+void gcfg_batch_cleanup(gcfg_parse_ctx_t *ctx);
+
+/*
+  The value store behind a batch, also used to keep the events of included
+  files. Appends a copy of a value, including its strings, to the values of
+  a batch. Returns 0 on success, -1 if out of memory.
+*/
+int gcfg_batch_store(gcfg_batch_t *batch, const gcfg_value_t *value);
+
+/*
+  Copies a string into the pool of a batch and returns its offset through
+  out, 0 for NULL. Returns 0 on success, -1 if out of memory.
+*/
+int gcfg_batch_store_string(gcfg_batch_t *batch, const char *str,
+			    size_t *out);
+
+/* Points the strings of the stored values into the pool once it is done. */
+void gcfg_batch_resolve(gcfg_batch_t *batch);
+
+/* Opens a block, fails if that exceeds the maximum depth. */
+int gcfg_push_block(gcfg_file_t *file, gcfg_parse_ctx_t *ctx,
+		    const gcfg_keyword_t *kwd, void *object);
+
+/* Closes the innermost block and returns its (now unused) stack entry. */
+gcfg_block_t *gcfg_pop_block(gcfg_parse_ctx_t *ctx);
+
+/*
+  Checks that the last line of a listing is a '}' line. Returns -1 after
+  reporting an error if it is not.
+*/
+int gcfg_listing_end(gcfg_file_t *file, const char *line);
+
+/*
+  Opens or closes blocks for an event, without calling any callbacks. A
+  listing then ends at a line consisting only of '}', whose event is turned
+  into the END_BLOCK event closing the listing. Returns 0 on success, -1 on
+  failure after reporting the error.
+*/
+int gcfg_track_event(gcfg_file_t *file, gcfg_parse_ctx_t *ctx,
+		     gcfg_event_t *ev);
+
+/*
+  Returns the size of the declaration at the start of data, i.e. of its
+  line including the line break and, if it opens a block, of all lines up
+  to and including the one that closes it. Only braces outside of strings
+  and comments count, blocks of keywords with a listing end at a line
+  consisting only of '}'. Adds the number of lines to *lines. Does not
+  check the syntax otherwise.
+*/
+size_t gcfg_scan_declaration(const char *data, size_t size,
+			     const gcfg_keyword_t *keywords,
+			     unsigned long *lines);
+
+/* Classifies the 64 bytes at data, using SIMD instructions if available. */
+void gcfg_scan_block(const char *data, gcfg_block_bits_t *out);
+
+/*
+  The implementations gcfg_scan_block picks from, so they can be tested
+  against each other. The SSE2 and AVX2 versions may only be called if
+  __builtin_cpu_supports reports the instruction set.
+*/
+void gcfg_scan_block_swar(const char *data, gcfg_block_bits_t *out);
+
+#ifdef GCFG_HAVE_X86_SIMD
+void gcfg_scan_block_sse2(const char *data, gcfg_block_bits_t *out);
+
+void gcfg_scan_block_avx2(const char *data, gcfg_block_bits_t *out);
+#endif
+
+/* Returns true if a line ends with a '{' outside of strings and comments. */
+bool gcfg_line_opens_block(const char *line, size_t length);
+
+/*
+  A document is a single block of memory, the header is followed by the
+  node array and then by the string pool. Offset 0 of the pool is never
+  used by a string, so it can stand for NULL.
+*/
+struct gcfg_document_t {
+	uint32_t node_count;
+	uint32_t string_size;
+
+	/*
+	  Size of the mapping if the document was loaded from a cache file,
+	  see doc_cache.c. 0 if it was allocated.
+	*/
+	uint64_t map_size;
+
+	gcfg_node_t nodes[];
+};
+
+/* Releases a document that was loaded from a cache file. */
+void gcfg_document_unmap(gcfg_document_t *doc);
+
+/*
+  Returns the path of the index-th file that was part of the configuration
+  when it was last parsed through the cache, continuing with the wildcard
+  patterns it used, for which *pattern is set. Returns NULL past the end.
+*/
+const char *gcfg_include_cache_path(const gcfg_include_cache_t *cache,
+				    size_t index, bool *pattern);
+
+/*
+  Creates a file with a chunk buffer that reads from the file descriptor fd,
+  initially set to -1. Prints an error message on failure. The result can be
+  disposed using gcfg_file_close.
+*/
+gcfg_stdio_file_t *gcfg_stdio_file_create(const char *name);
+
+/*
+  Reads everything from a file descriptor into a buffer allocated with
+  malloc, followed by a null byte, and stores the number of bytes read in
+  size. Unlike a mapping, the buffer stays valid if the file is truncated
+  in the meantime. Returns NULL and sets errno on failure.
+*/
+char *gcfg_read_fd(int fd, size_t *size);
+
+/* initial value for a hash computed with gcfg_hash_bytes */
+#define GCFG_HASH_SEED (0xCBF29CE484222325UL)
+
+/*
+  Mixes size bytes from data into a 64 bit hash and returns the result.
+  Hashing data in pieces gives the same result as hashing it in one go only
+  if the pieces are the same. Not meant to resist deliberate collisions.
+*/
+uint64_t gcfg_hash_bytes(uint64_t hash, const void *data, size_t size);
+
+#endif /* INTERNAL_H */
@@ -4,7 +4,11 @@
  *
  * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
  */
-#include "gcfg.h"
+#include "internal.h"
+
+#ifdef GCFG_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
 
 static const uint32_t min_val_by_count[] = {
 	0xFFFFFFFF,
@@ -46,36 +50,130 @@ bool gcfg_is_valid_cp(uint32_t cp)
 	return true;
 }
 
-bool gcfg_is_valid_utf8(const uint8_t *str, size_t len)
+/* Checks the sequence at str and returns a pointer past it, NULL if invalid */
+static const uint8_t *check_sequence(const uint8_t *str, const uint8_t *end)
 {
-	size_t i, count = 0;
+	size_t i, count;
 	uint32_t cp;
 	uint8_t x;
 
-	while (len--) {
-		x = *(str++);
-		count = seq_length[(x >> 2) & 0x3F];
-		cp = x & mask_by_count[count];
+	x = *(str++);
+	count = seq_length[(x >> 2) & 0x3F];
+	cp = x & mask_by_count[count];
+
+	if (count > 1) {
+		if ((size_t)(end - str) < (count - 1))
+			return NULL;
+
+		for (i = 1; i < count; ++i) {
+			x = *(str++);
+
+			if ((x & 0xC0) != 0x80)
+				return NULL;
+
+			cp = (cp << 6) | (x & 0x3F);
+		}
+	}
+
+	if (cp < min_val_by_count[count] && cp != 0x09)
+		return NULL;
+
+	if (!gcfg_is_valid_cp(cp) || cp == 0x7F)
+		return NULL;
+
+	return str;
+}
+
+#ifdef GCFG_HAVE_X86_SIMD
+/*
+  Skips blocks of printable ASCII characters and tabs, the only single byte
+  sequences accepted by check_sequence, and only decodes what is left.
+*/
+__attribute__((target("sse2")))
+static bool is_valid_sse2(const uint8_t *str, const uint8_t *end)
+{
+	const __m128i ctrl = _mm_set1_epi8(0x1F);
+	const __m128i del = _mm_set1_epi8(0x7F);
+	const __m128i tab = _mm_set1_epi8(0x09);
+	unsigned int mask;
+	__m128i v, ok;
+
+	while (str < end) {
+		if ((end - str) >= 16) {
+			v = _mm_loadu_si128((const void *)str);
+
+			/* bytes >= 0x80 are negative, i.e. less than 0x1F */
+			ok = _mm_andnot_si128(_mm_cmpeq_epi8(v, del),
+					      _mm_cmpgt_epi8(v, ctrl));
+			ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, tab));
+			mask = (unsigned int)_mm_movemask_epi8(ok);
+
+			if (mask == 0xFFFF) {
+				str += 16;
+				continue;
+			}
 
-		if (count > 1) {
-			if (len < (count - 1))
-				return false;
+			str += __builtin_ctz(~mask);
+		}
 
-			for (i = 1; i < count; ++i) {
-				x = *(str++);
-				--len;
+		str = check_sequence(str, end);
+		if (str == NULL)
+			return false;
+	}
 
-				if ((x & 0xC0) != 0x80)
-					return false;
+	return true;
+}
 
-				cp = (cp << 6) | (x & 0x3F);
+__attribute__((target("avx2")))
+static bool is_valid_avx2(const uint8_t *str, const uint8_t *end)
+{
+	const __m256i ctrl = _mm256_set1_epi8(0x1F);
+	const __m256i del = _mm256_set1_epi8(0x7F);
+	const __m256i tab = _mm256_set1_epi8(0x09);
+	unsigned int mask;
+	__m256i v, ok;
+
+	while (str < end) {
+		if ((end - str) >= 32) {
+			v = _mm256_loadu_si256((const void *)str);
+
+			ok = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, del),
+						 _mm256_cmpgt_epi8(v, ctrl));
+			ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, tab));
+			mask = (unsigned int)_mm256_movemask_epi8(ok);
+
+			if (mask == 0xFFFFFFFF) {
+				str += 32;
+				continue;
 			}
+
+			str += __builtin_ctz(~mask);
 		}
 
-		if (cp < min_val_by_count[count] && cp != 0x09)
+		str = check_sequence(str, end);
+		if (str == NULL)
 			return false;
+	}
+
+	return true;
+}
+#endif
+
+bool gcfg_is_valid_utf8(const uint8_t *str, size_t len)
+{
+	const uint8_t *end = str + len;
+
+#ifdef GCFG_HAVE_X86_SIMD
+	if (__builtin_cpu_supports("avx2"))
+		return is_valid_avx2(str, end);
+
+	if (__builtin_cpu_supports("sse2"))
+		return is_valid_sse2(str, end);
+#endif
 
-		if (!gcfg_is_valid_cp(cp) || cp == 0x7F)
+	while (str < end) {
+		str = check_sequence(str, end);
+		if (str == NULL)
 			return false;
 	}
 
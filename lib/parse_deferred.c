@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * parse_deferred.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+int gcfg_parse_deferred(gcfg_file_t *file, const gcfg_deferred_t *body,
+			void *object)
+{
+	gcfg_block_t stack[GCFG_DEFAULT_MAX_DEPTH];
+	gcfg_parse_ctx_t ctx;
+	gcfg_event_t ev;
+	int ret;
+
+	if (gcfg_file_seek_line(file, body->line))
+		return -1;
+
+	if (gcfg_parse_ctx_init(&ctx, body->keyword->children, object, stack,
+				GCFG_DEFAULT_MAX_DEPTH)) {
+		file->report_error(file, "out of memory");
+		return -1;
+	}
+
+	ctx.linenum = body->line - 1;
+
+	/* the closing '}' of the block itself ends the body */
+	ret = gcfg_push_block(file, &ctx, body->keyword, object);
+
+	while (ret == 0) {
+		ret = gcfg_next_event(file, &ctx, &ev);
+		if (ret != 0) {
+			ret = -1;
+			break;
+		}
+
+		if (ev.type == GCFG_EVENT_END_BLOCK && ctx.depth == 1) {
+			ret = gcfg_batch_flush(file, &ctx);
+			break;
+		}
+
+		ret = gcfg_apply_event(file, &ctx, &ev);
+	}
+
+	gcfg_parse_ctx_cleanup(&ctx);
+	return ret;
+}
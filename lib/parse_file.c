@@ -4,9 +4,13 @@
  *
  * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
  */
-#include "gcfg.h"
+#include "internal.h"
 
 #include <string.h>
+#include <stdlib.h>
+
+/* smaller keyword lists are searched linearly */
+#define KEYWORD_INDEX_MIN (8)
 
 static const char *skip_space(const char *ptr)
 {
@@ -20,19 +24,291 @@ static int is_line_end(int c)
 	return c == '\0' || c == '#';
 }
 
-static const char *find_keyword(gcfg_file_t *file,
-				const gcfg_keyword_t *keywords,
+/* Returns the same as fetch_line. The line is not checked in any way. */
+static int read_line(gcfg_file_t *file, gcfg_parse_ctx_t *ctx)
+{
+	int ret;
+
+	ctx->error = 0;
+	ctx->column = 0;
+	ctx->opens_block = false;
+
+	if (file->fetch_lines == NULL) {
+		ret = file->fetch_line(file);
+		if (ret != 0)
+			return ret;
+	} else if (file->line_index + 1 < file->line_count) {
+		file->line_index += 1;
+		file->buffer = file->lines[file->line_index].data;
+	} else {
+		ret = file->fetch_lines(file);
+		if (ret != 0)
+			return ret;
+
+		file->line_index = 0;
+		file->buffer = file->lines[0].data;
+	}
+
+	ctx->linenum += 1;
+	return 0;
+}
+
+/* Returns the same as fetch_line. Lines that are not valid UTF-8 are
+   reported as an error. */
+static int next_line(gcfg_file_t *file, gcfg_parse_ctx_t *ctx)
+{
+	gcfg_line_t *line;
+	int ret;
+
+	ret = read_line(file, ctx);
+	if (ret != 0)
+		return ret;
+
+	if (file->fetch_lines == NULL) {
+		if (!gcfg_is_valid_utf8((const uint8_t *)file->buffer,
+					strlen(file->buffer))) {
+			goto fail_utf8;
+		}
+		return 0;
+	}
+
+	line = file->lines + file->line_index;
+
+	if (!(line->flags & GCFG_LINE_VALID_UTF8) &&
+	    !gcfg_is_valid_utf8((const uint8_t *)line->data, line->length)) {
+		goto fail_utf8;
+	}
+	return 0;
+fail_utf8:
+	ctx->error = GCFG_DIAG_ENCODING;
+	file->report_error(file, "encoding error (expected UTF-8)");
+	return -1;
+}
+
+static bool is_keyword_end(int c)
+{
+	return c == ' ' || c == '\t' || is_line_end(c);
+}
+
+static uint32_t hash_name(const char *name, size_t len)
+{
+	uint32_t hash = 0x811C9DC5;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		hash ^= (uint8_t)name[i];
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+/*
+  Returns the number of hash slots for a list, 0 to search it linearly, and
+  stores the number of keywords in count.
+*/
+static size_t index_slots(const gcfg_keyword_t *keywords, size_t *count)
+{
+	size_t i, size;
+	bool linear = false;
+
+	for (*count = 0; keywords[*count].name != NULL; ++(*count)) {
+		/* names that cannot be isolated as a single token */
+		for (i = 0; keywords[*count].name[i] != '\0'; ++i) {
+			if (is_keyword_end(keywords[*count].name[i]))
+				linear = true;
+		}
+	}
+
+	if (linear || *count < KEYWORD_INDEX_MIN || *count >= UINT32_MAX / 2)
+		return 0;
+
+	for (size = 16; size < 2 * *count; size *= 2)
+		;
+
+	return size;
+}
+
+/* the children of an index follow its slots, aligned for a pointer */
+static size_t children_offset(size_t slots)
+{
+	size_t size = sizeof(gcfg_keyword_index_t) + slots * sizeof(uint32_t);
+
+	return (size + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+}
+
+/* the index must be cleared */
+static void fill_index(gcfg_keyword_index_t *idx,
+		       const gcfg_keyword_t *keywords, size_t count,
+		       size_t size)
+{
+	uint32_t pos;
+	size_t i, len;
+
+	idx->list = keywords;
+	idx->count = count;
+	idx->children = (void *)((char *)idx + children_offset(size));
+
+	if (size == 0)
+		return;
+
+	idx->mask = (uint32_t)size - 1;
+
+	for (i = 0; keywords[i].name != NULL; ++i) {
+		len = strlen(keywords[i].name);
+		pos = hash_name(keywords[i].name, len) & idx->mask;
+
+		/* for duplicate names, keep the first like a linear scan */
+		while (idx->slots[pos] != 0) {
+			if (strcmp(keywords[idx->slots[pos] - 1].name,
+				   keywords[i].name) == 0) {
+				break;
+			}
+
+			pos = (pos + 1) & idx->mask;
+		}
+
+		if (idx->slots[pos] == 0)
+			idx->slots[pos] = (uint32_t)i + 1;
+	}
+}
+
+/* takes an index from the memory handed to gcfg_parse_ctx_init_arena */
+static gcfg_keyword_index_t *carve_index(gcfg_parse_ctx_t *ctx, size_t size)
+{
+	gcfg_keyword_index_t *idx;
+	size_t words;
+
+	words = (size + sizeof(ctx->arena[0]) - 1) / sizeof(ctx->arena[0]);
+
+	if (ctx->arena_size - ctx->arena_used < words)
+		return NULL;
+
+	idx = (gcfg_keyword_index_t *)(ctx->arena + ctx->arena_used);
+	ctx->arena_used += words;
+
+	memset(idx, 0, size);
+	return idx;
+}
+
+static const gcfg_keyword_index_t *get_index(gcfg_parse_ctx_t *ctx,
+					     const gcfg_keyword_t *keywords)
+{
+	gcfg_keyword_index_t *idx;
+	size_t slots, count, size;
+
+	for (idx = ctx->indices; idx != NULL; idx = idx->next) {
+		if (idx->list == keywords)
+			return idx;
+	}
+
+	if (ctx->no_index)
+		return NULL;
+
+	slots = index_slots(keywords, &count);
+	size = children_offset(slots) + count * sizeof(idx->children[0]);
+
+	if (ctx->arena != NULL) {
+		idx = carve_index(ctx, size);
+
+		/* if the memory runs out, the list is searched linearly */
+		if (idx == NULL && slots > 0) {
+			slots = 0;
+			size = children_offset(slots) +
+			       count * sizeof(idx->children[0]);
+			idx = carve_index(ctx, size);
+		}
+	} else {
+#ifdef GCFG_DISABLE_ALLOC
+		idx = NULL;
+#else
+		idx = calloc(1, size);
+#endif
+	}
+
+	if (idx == NULL) {
+		ctx->no_index = true;
+		return NULL;
+	}
+
+	fill_index(idx, keywords, count, slots);
+	idx->next = ctx->indices;
+	ctx->indices = idx;
+	return idx;
+}
+
+/* looks up the index of the children of a keyword from the current list */
+static const gcfg_keyword_index_t *child_index(gcfg_parse_ctx_t *ctx,
+					       const gcfg_keyword_t *kwd)
+{
+	const gcfg_keyword_index_t *parent = ctx->index;
+	uintptr_t pos;
+
+	/* a block may be pushed for a keyword from somewhere else */
+	if (parent == NULL || (uintptr_t)kwd < (uintptr_t)parent->list)
+		return get_index(ctx, kwd->children);
+
+	pos = ((uintptr_t)kwd - (uintptr_t)parent->list) / sizeof(*kwd);
+
+	if (pos >= parent->count || parent->list + pos != kwd)
+		return get_index(ctx, kwd->children);
+
+	if (parent->children[pos] == NULL)
+		parent->children[pos] = get_index(ctx, kwd->children);
+
+	return parent->children[pos];
+}
+
+void gcfg_parse_ctx_cleanup(gcfg_parse_ctx_t *ctx)
+{
+#ifdef GCFG_DISABLE_ALLOC
+	(void)ctx;
+#else
+	gcfg_keyword_index_t *idx;
+
+	while (ctx->arena == NULL && ctx->indices != NULL) {
+		idx = ctx->indices;
+		ctx->indices = idx->next;
+		free(idx);
+	}
+
+	if (ctx->own_stack)
+		free(ctx->stack);
+
+	ctx->stack = NULL;
+	ctx->own_stack = false;
+	gcfg_batch_cleanup(ctx);
+#endif
+}
+
+/* returns NULL if there is no such keyword, without reporting an error */
+static const char *find_keyword(const gcfg_keyword_t *keywords,
+				const gcfg_keyword_index_t *idx,
 				const char *ptr,
 				const gcfg_keyword_t **out)
 {
 	const gcfg_keyword_t *kwd;
+	uint32_t pos;
 	size_t len;
 
-	if (!(*ptr >= 'a' && *ptr <= 'z') &&
-	    !(*ptr >= 'A' && *ptr <= 'Z') &&
-	    !(*ptr >= '0' && *ptr <= '9')) {
-		file->report_error(file, "Expected keyword, found '%.6s...'",
-				   ptr);
+	if (idx != NULL && idx->mask != 0) {
+		for (len = 0; !is_keyword_end(ptr[len]); ++len)
+			;
+
+		pos = hash_name(ptr, len) & idx->mask;
+
+		while (idx->slots[pos] != 0) {
+			kwd = keywords + idx->slots[pos] - 1;
+
+			if (strncmp(ptr, kwd->name, len) == 0 &&
+			    kwd->name[len] == '\0') {
+				*out = kwd;
+				return skip_space(ptr + len);
+			}
+
+			pos = (pos + 1) & idx->mask;
+		}
+
 		return NULL;
 	}
 
@@ -42,19 +318,17 @@ static const char *find_keyword(gcfg_file_t *file,
 		if (strncmp(ptr, kwd->name, len) != 0)
 			continue;
 
-		if (ptr[len] == ' ' || ptr[len] == '\t' ||
-		    is_line_end(ptr[len])) {
+		if (is_keyword_end(ptr[len])) {
 			*out = kwd;
 			return skip_space(ptr + len);
 		}
 	}
 
-	file->report_error(file, "Unknown keyword '%.6s...'", ptr);
 	return NULL;
 }
 
-static const char *apply_arg(gcfg_file_t *file, const gcfg_keyword_t *kwd,
-			     const char *ptr, void *parent, void **child_out)
+static const char *parse_arg(gcfg_file_t *file, const gcfg_keyword_t *kwd,
+			     const char *ptr, gcfg_value_t *out)
 {
 	gcfg_value_t val;
 	char *strval;
@@ -121,144 +395,255 @@ static const char *apply_arg(gcfg_file_t *file, const gcfg_keyword_t *kwd,
 	if (ptr == NULL)
 		return NULL;
 
-	*child_out = kwd->set_property(file, parent, &val);
+	*out = val;
 	return skip_space(ptr);
 }
 
-static int plain_listing(gcfg_file_t *file, const gcfg_keyword_t *keyword,
-			 void *object)
+static const gcfg_keyword_t *current_list(const gcfg_parse_ctx_t *ctx)
 {
-	const char *ptr;
-	int ret;
+	if (ctx->depth == 0)
+		return ctx->keywords;
 
-	for (;;) {
-		ret = file->fetch_line(file);
-		if (ret < 0)
-			return -1;
-		if (ret > 0)
-			goto fail_closeing;
+	return ctx->stack[ctx->depth - 1].keyword->children;
+}
 
-		ptr = file->buffer;
-		if (!gcfg_is_valid_utf8((const uint8_t *)ptr, strlen(ptr)))
-			goto fail_utf8;
+static void *current_object(const gcfg_parse_ctx_t *ctx)
+{
+	if (ctx->depth == 0)
+		return ctx->object;
 
-		ret = keyword->handle_listing(file, object, ptr);
-		if (ret < 0)
-			return -1;
+	return ctx->stack[ctx->depth - 1].object;
+}
 
-		if (ret > 0) {
-			ptr = skip_space(ptr);
-			if (*ptr != '}')
-				goto fail_closeing;
+static unsigned long column_of(const gcfg_file_t *file, const char *ptr)
+{
+	return (unsigned long)(ptr - file->buffer) + 1;
+}
 
-			ptr = skip_space(ptr + 1);
-			if (!is_line_end(*ptr))
-				goto fail_brace_extra;
-			break;
-		}
+static bool in_listing(const gcfg_parse_ctx_t *ctx)
+{
+	return ctx->depth > 0 &&
+		ctx->stack[ctx->depth - 1].keyword->handle_listing != NULL;
+}
+
+int gcfg_push_block(gcfg_file_t *file, gcfg_parse_ctx_t *ctx,
+		    const gcfg_keyword_t *kwd, void *object)
+{
+	if (ctx->depth >= ctx->max_depth) {
+		ctx->error = GCFG_DIAG_NESTING;
+		file->report_error(file, "blocks nested too deeply "
+				   "(maximum is %lu)",
+				   (unsigned long)ctx->max_depth);
+		return -1;
 	}
+
+	/* listings have no keywords, they keep the index of the parent */
+	if (kwd->handle_listing == NULL)
+		ctx->index = child_index(ctx, kwd);
+
+	ctx->stack[ctx->depth].keyword = kwd;
+	ctx->stack[ctx->depth].object = object;
+	ctx->stack[ctx->depth].index = ctx->index;
+	ctx->depth += 1;
 	return 0;
-fail_closeing:
-	file->report_error(file, "missing '}' after listing");
-	return -1;
-fail_utf8:
-	file->report_error(file, "encoding error (expected UTF-8)");
-	return -1;
-fail_brace_extra:
-	file->report_error(file, "'{' or '}' must be followed by a line break");
-	return -1;
 }
 
-static int parse(gcfg_file_t *file, const gcfg_keyword_t *keywords,
-		 void *parent, unsigned int level)
+gcfg_block_t *gcfg_pop_block(gcfg_parse_ctx_t *ctx)
 {
-	const gcfg_keyword_t *kwd;
-	const char *ptr;
+	ctx->depth -= 1;
+
+	if (ctx->depth == 0) {
+		ctx->index = ctx->root_index;
+	} else {
+		ctx->index = ctx->stack[ctx->depth - 1].index;
+	}
+
+	return ctx->stack + ctx->depth;
+}
+
+int gcfg_listing_end(gcfg_file_t *file, const char *line)
+{
+	line = skip_space(line);
+	if (*line != '}') {
+		file->report_error(file, "missing '}' after listing");
+		return -1;
+	}
+
+	line = skip_space(line + 1);
+	if (!is_line_end(*line)) {
+		file->report_error(file, "'{' or '}' must be followed by a "
+				   "line break");
+		return -1;
+	}
+
+	return 0;
+}
+
+int gcfg_track_event(gcfg_file_t *file, gcfg_parse_ctx_t *ctx,
+		     gcfg_event_t *ev)
+{
+	switch (ev->type) {
+	case GCFG_EVENT_BEGIN_BLOCK:
+		return gcfg_push_block(file, ctx, ev->keyword, NULL);
+	case GCFG_EVENT_LISTING_LINE:
+		/* without a callback to ask, a '}' line ends the listing */
+		if (*skip_space(ev->line) != '}')
+			return 0;
+
+		if (gcfg_listing_end(file, ev->line))
+			return -1;
+
+		ev->type = GCFG_EVENT_END_BLOCK;
+		gcfg_pop_block(ctx);
+		return 0;
+	case GCFG_EVENT_END_BLOCK:
+		gcfg_pop_block(ctx);
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+static int include_directive(gcfg_file_t *file, const char *ptr,
+			     gcfg_parse_ctx_t *ctx)
+{
+	char *path = file->buffer;
+
+	ptr = gcfg_parse_string(file, skip_space(ptr), path);
+	if (ptr == NULL)
+		return -1;
+
+	ptr = skip_space(ptr);
+	if (!is_line_end(*ptr)) {
+		file->report_error(file, "'include <path>' must be followed "
+				   "by a line break");
+		return -1;
+	}
+
+	return ctx->include(ctx, file, path);
+}
+
+/*
+  Skips the line of an unknown keyword and, if it opens a block, everything
+  up to the matching '}'. Returns the same as parse_line.
+*/
+static int skip_unknown(gcfg_file_t *file, gcfg_parse_ctx_t *ctx)
+{
+	if (!gcfg_line_opens_block(file->buffer, strlen(file->buffer)))
+		return 1;
+
+	return gcfg_skip_block(file, ctx) ? -1 : 1;
+}
+
+/*
+  Turns the line in file->buffer into an event. Returns 0 on success,
+  > 0 if the line does not produce an event, < 0 on failure.
+*/
+static int parse_line(gcfg_file_t *file, gcfg_parse_ctx_t *ctx,
+		      gcfg_event_t *ev)
+{
+	const gcfg_keyword_t *kwd = NULL;
+	const char *ptr, *kwd_end;
+	unsigned long start;
 	bool have_args;
-	void *child;
-	int ret;
 
-	for (;;) {
-		ret = file->fetch_line(file);
-		if (ret < 0)
+	memset(ev, 0, sizeof(*ev));
+
+	if (in_listing(ctx)) {
+		ev->type = GCFG_EVENT_LISTING_LINE;
+		ev->keyword = ctx->stack[ctx->depth - 1].keyword;
+		ev->line = file->buffer;
+		return 0;
+	}
+
+	if (ctx->recover) {
+		ctx->opens_block = gcfg_line_opens_block(file->buffer,
+							 strlen(file->buffer));
+	}
+
+	ptr = skip_space(file->buffer);
+	start = column_of(file, ptr);
+	ctx->column = start;
+	ctx->error = GCFG_DIAG_SYNTAX;
+
+	if (ctx->include != NULL && strncmp(ptr, "include", 7) == 0 &&
+	    (ptr[7] == ' ' || ptr[7] == '\t')) {
+		return include_directive(file, ptr + 7, ctx) ? -1 : 1;
+	}
+
+	if ((*ptr >= 'a' && *ptr <= 'z') || (*ptr >= 'A' && *ptr <= 'Z')) {
+		ctx->error = GCFG_DIAG_UNKNOWN_KEYWORD;
+		kwd_end = find_keyword(current_list(ctx), ctx->index, ptr,
+				       &kwd);
+		if (kwd_end == NULL) {
+			if (ctx->tolerant)
+				return skip_unknown(file, ctx);
+
+			file->report_error(file, "Unknown keyword '%.6s...'",
+					   ptr);
 			return -1;
-		if (ret > 0) {
-			if (level != 0)
-				goto fail_closeing;
-			break;
 		}
 
-		if (!gcfg_is_valid_utf8((const uint8_t *)file->buffer,
-					strlen(file->buffer))) {
-			goto fail_utf8;
-		}
+		ptr = kwd_end;
 
-		kwd = NULL;
-		child = NULL;
-		ptr = skip_space(file->buffer);
+		have_args = !is_line_end(*ptr) && *ptr != '{' && *ptr != '}';
 
-		if ((*ptr >= 'a' && *ptr <= 'z') ||
-		    (*ptr >= 'A' && *ptr <= 'Z')) {
-			ptr = find_keyword(file, keywords, ptr, &kwd);
-			if (ptr == NULL)
-				return -1;
-
-			have_args = !is_line_end(*ptr) && *ptr != '{' &&
-				    *ptr != '}';
-
-			if (!have_args && kwd->arg != GCFG_VALUE_NONE)
-				goto fail_missing_arg;
-
-			if (have_args && kwd->arg == GCFG_VALUE_NONE)
-				goto fail_have_arg;
-
-			ptr = apply_arg(file, kwd, ptr, parent, &child);
-			if (ptr == NULL || child == NULL)
-				return -1;
-
-			if (*ptr == '{') {
-				ptr = skip_space(ptr + 1);
-				if (!is_line_end(*ptr))
-					goto fail_brace_extra;
-				if (kwd->handle_listing != NULL) {
-					if (plain_listing(file, kwd, child))
-						return -1;
-				} else {
-					if (kwd->children == NULL)
-						goto fail_children;
-					if (parse(file, kwd->children,
-						  child, level + 1)) {
-						return -1;
-					}
-				}
-			} else if (!is_line_end(*ptr)) {
-				goto fail_kwd_extra;
-			}
+		ctx->column = column_of(file, ptr);
+		ctx->error = GCFG_DIAG_ARGUMENT;
 
-			if (kwd->finalize_object != NULL) {
-				if (kwd->finalize_object(file, child))
-					return -1;
-			}
-		} else if (*ptr == '}') {
-			if (level == 0)
-				goto fail_level;
+		if (!have_args && kwd->arg != GCFG_VALUE_NONE)
+			goto fail_missing_arg;
+
+		if (have_args && kwd->arg == GCFG_VALUE_NONE)
+			goto fail_have_arg;
+
+		ptr = parse_arg(file, kwd, ptr, &ev->value);
+		if (ptr == NULL)
+			return -1;
+
+		ev->keyword = kwd;
+		ev->type = GCFG_EVENT_VALUE;
+
+		ctx->column = column_of(file, ptr);
+		ctx->error = GCFG_DIAG_SYNTAX;
+
+		if (*ptr == '{') {
 			ptr = skip_space(ptr + 1);
 			if (!is_line_end(*ptr))
 				goto fail_brace_extra;
-			break;
+			if (kwd->handle_listing == NULL &&
+			    kwd->children == NULL) {
+				goto fail_children;
+			}
+
+			ev->type = GCFG_EVENT_BEGIN_BLOCK;
 		} else if (!is_line_end(*ptr)) {
-			file->report_error(file, "Unexpected %.6s...", ptr);
-			return -1;
+			goto fail_kwd_extra;
 		}
+
+		/* later errors, e.g. from callbacks, concern the keyword */
+		ctx->column = start;
+		return 0;
 	}
 
-	return 0;
-fail_closeing:
-	file->report_error(file, "missing '}' before end-of-file");
-	return -1;
-fail_utf8:
-	file->report_error(file, "encoding error (expected UTF-8)");
-	return -1;
+	if (*ptr == '}') {
+		if (ctx->depth == ctx->base)
+			goto fail_level;
+		ptr = skip_space(ptr + 1);
+		if (!is_line_end(*ptr))
+			goto fail_brace_extra;
+
+		ev->type = GCFG_EVENT_END_BLOCK;
+		ev->keyword = ctx->stack[ctx->depth - 1].keyword;
+		return 0;
+	}
+
+	if (!is_line_end(*ptr)) {
+		file->report_error(file, "Unexpected %.6s...", ptr);
+		return -1;
+	}
+
+	return 1;
 fail_kwd_extra:
 	if (kwd->arg == GCFG_VALUE_NONE) {
 		file->report_error(file, "'%s' must be folled "
@@ -269,9 +654,11 @@ fail_kwd_extra:
 	}
 	return -1;
 fail_brace_extra:
+	ctx->column = column_of(file, ptr);
 	file->report_error(file, "'{' or '}' must be followed by a line break");
 	return -1;
 fail_level:
+	ctx->error = GCFG_DIAG_NESTING;
 	file->report_error(file, "Unexpected '}' outside block");
 	return -1;
 fail_children:
@@ -285,8 +672,296 @@ fail_have_arg:
 	return -1;
 }
 
+int gcfg_next_event(gcfg_file_t *file, gcfg_parse_ctx_t *ctx,
+		    gcfg_event_t *ev)
+{
+	int ret;
+
+	do {
+		ret = next_line(file, ctx);
+		if (ret < 0)
+			return -1;
+
+		if (ret > 0) {
+			ctx->eof = true;
+
+			if (ctx->depth == ctx->base || ctx->incomplete)
+				return 1;
+
+			ctx->error = GCFG_DIAG_NESTING;
+
+			if (in_listing(ctx)) {
+				file->report_error(file, "missing '}' after "
+						   "listing");
+			} else {
+				file->report_error(file, "missing '}' before "
+						   "end-of-file");
+			}
+			return -1;
+		}
+
+		ret = parse_line(file, ctx, ev);
+	} while (ret > 0);
+
+	ev->linenum = ctx->linenum;
+	return ret;
+}
+
+static void init_root(gcfg_parse_ctx_t *ctx, const gcfg_keyword_t *keywords,
+		      void *usr, gcfg_block_t *stack, size_t max_depth)
+{
+	ctx->keywords = keywords;
+	ctx->object = usr;
+	ctx->stack = stack;
+	ctx->max_depth = max_depth;
+	ctx->root_index = get_index(ctx, keywords);
+	ctx->index = ctx->root_index;
+}
+
+int gcfg_parse_ctx_init(gcfg_parse_ctx_t *ctx, const gcfg_keyword_t *keywords,
+			void *usr, gcfg_block_t *stack, size_t max_depth)
+{
+	memset(ctx, 0, sizeof(*ctx));
+
+	if (stack == NULL && max_depth > 0) {
+#ifdef GCFG_DISABLE_ALLOC
+		return -1;
+#else
+		stack = calloc(max_depth, sizeof(stack[0]));
+		if (stack == NULL)
+			return -1;
+
+		ctx->own_stack = true;
+#endif
+	}
+
+	init_root(ctx, keywords, usr, stack, max_depth);
+	return 0;
+}
+
+void gcfg_parse_ctx_init_arena(gcfg_parse_ctx_t *ctx,
+			       const gcfg_keyword_t *keywords, void *usr,
+			       gcfg_block_t *stack, size_t max_depth,
+			       uintptr_t *arena, size_t size)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->arena = arena;
+	ctx->arena_size = size;
+	init_root(ctx, keywords, usr, stack, max_depth);
+}
+
+/* skips the body of a block and hands its location to the keyword */
+static int defer_block(gcfg_file_t *file, gcfg_parse_ctx_t *ctx,
+		       const gcfg_keyword_t *kwd, void *child)
+{
+	gcfg_deferred_t body;
+
+	body.keyword = kwd;
+	body.line = ctx->linenum + 1;
+
+	if (gcfg_skip_block(file, ctx))
+		return -1;
+
+	body.count = ctx->linenum + 1 - body.line;
+	ctx->error = GCFG_DIAG_CALLBACK;
+
+	if (kwd->handle_deferred != NULL &&
+	    kwd->handle_deferred(file, child, &body)) {
+		return -1;
+	}
+
+	if (kwd->finalize_object != NULL)
+		return kwd->finalize_object(file, child);
+	return 0;
+}
+
+int gcfg_apply_event(gcfg_file_t *file, gcfg_parse_ctx_t *ctx,
+		     const gcfg_event_t *ev)
+{
+	const gcfg_keyword_t *kwd = ev->keyword;
+	gcfg_block_t *top;
+	void *child;
+	int ret;
+
+	/* anything but another value of the same keyword ends a batch */
+	if (ctx->batch.count > 0 && (ev->type != GCFG_EVENT_VALUE ||
+				     kwd != ctx->batch.keyword)) {
+		if (gcfg_batch_flush(file, ctx))
+			return -1;
+	}
+
+	ctx->error = GCFG_DIAG_CALLBACK;
+
+	switch (ev->type) {
+	case GCFG_EVENT_BEGIN_BLOCK:
+	case GCFG_EVENT_VALUE:
+		if (ev->type == GCFG_EVENT_VALUE &&
+		    (kwd->flags & GCFG_KEYWORD_BATCH)) {
+			return gcfg_batch_add(file, ctx, kwd, &ev->value);
+		}
+
+		child = kwd->set_property(file, current_object(ctx),
+					  &ev->value);
+		if (child == NULL)
+			return -1;
+
+		if (ev->type == GCFG_EVENT_BEGIN_BLOCK) {
+			if ((kwd->flags & GCFG_KEYWORD_DEFERRED) &&
+			    kwd->handle_listing == NULL && !ctx->no_defer) {
+				return defer_block(file, ctx, kwd, child);
+			}
+
+			return gcfg_push_block(file, ctx, kwd, child);
+		}
+
+		if (kwd->finalize_object != NULL)
+			return kwd->finalize_object(file, child);
+		return 0;
+	case GCFG_EVENT_LISTING_LINE:
+		top = ctx->stack + ctx->depth - 1;
+
+		ret = kwd->handle_listing(file, top->object, ev->line);
+		if (ret <= 0)
+			return ret;
+
+		ctx->error = GCFG_DIAG_SYNTAX;
+		if (gcfg_listing_end(file, ev->line)) {
+			gcfg_pop_block(ctx);
+			return -1;
+		}
+
+		ctx->error = GCFG_DIAG_CALLBACK;
+		break;
+	case GCFG_EVENT_END_BLOCK:
+		break;
+	default:
+		return -1;
+	}
+
+	top = gcfg_pop_block(ctx);
+
+	if (kwd->finalize_object != NULL)
+		return kwd->finalize_object(file, top->object);
+	return 0;
+}
+
+int gcfg_skip_block(gcfg_file_t *file, gcfg_parse_ctx_t *ctx)
+{
+	const char *ptr;
+	size_t depth = 1;
+	int ret;
+
+	/* nothing in the block is checked, not even the encoding */
+	while (depth > 0) {
+		ret = read_line(file, ctx);
+		if (ret < 0)
+			return -1;
+
+		if (ret > 0) {
+			ctx->eof = true;
+			ctx->error = GCFG_DIAG_NESTING;
+			file->report_error(file, "missing '}' before "
+					   "end-of-file");
+			return -1;
+		}
+
+		ptr = skip_space(file->buffer);
+
+		if (*ptr == '}') {
+			depth -= 1;
+		} else if (gcfg_line_opens_block(ptr, strlen(ptr))) {
+			depth += 1;
+		}
+	}
+
+	return 0;
+}
+
+int gcfg_parse_events(gcfg_file_t *file, gcfg_parse_ctx_t *ctx)
+{
+	gcfg_event_t ev;
+	int ret;
+
+	for (;;) {
+		ret = gcfg_next_event(file, ctx, &ev);
+		if (ret < 0)
+			return -1;
+		/* a batch may continue with the next piece of input */
+		if (ret > 0) {
+			if (ctx->incomplete)
+				return 0;
+			return gcfg_batch_flush(file, ctx);
+		}
+
+		if (ctx->record != NULL)
+			ctx->record(ctx, &ev);
+
+		ret = gcfg_apply_event(file, ctx, &ev);
+		if (ret != 0)
+			return ret;
+	}
+}
+
+int gcfg_parse_fragment(gcfg_file_t *file, gcfg_parse_ctx_t *ctx)
+{
+	size_t base = ctx->base;
+	int ret;
+
+	ctx->base = ctx->depth;
+	ret = gcfg_parse_events(file, ctx);
+	ctx->base = base;
+	return ret;
+}
+
+static int parse_file(gcfg_file_t *file, const gcfg_keyword_t *keywords,
+		      void *usr, gcfg_block_t *stack, size_t max_depth,
+		      uint32_t flags, unsigned long linenum)
+{
+	gcfg_parse_ctx_t ctx;
+	int ret;
+
+	if (gcfg_parse_ctx_init(&ctx, keywords, usr, stack, max_depth)) {
+		file->report_error(file, "out of memory");
+		return -1;
+	}
+
+	ctx.tolerant = (flags & GCFG_PARSE_TOLERANT) != 0;
+	ctx.linenum = linenum;
+
+	ret = gcfg_parse_fragment(file, &ctx);
+	gcfg_parse_ctx_cleanup(&ctx);
+	return ret;
+}
+
+int gcfg_parse_file_depth(gcfg_file_t *file, const gcfg_keyword_t *keywords,
+			  void *usr, gcfg_block_t *stack, size_t max_depth)
+{
+	return parse_file(file, keywords, usr, stack, max_depth, 0, 0);
+}
+
+int gcfg_parse_file_flags(gcfg_file_t *file, const gcfg_keyword_t *keywords,
+			  void *usr, uint32_t flags)
+{
+	gcfg_block_t stack[GCFG_DEFAULT_MAX_DEPTH];
+
+	return parse_file(file, keywords, usr, stack, GCFG_DEFAULT_MAX_DEPTH,
+			  flags, 0);
+}
+
+int gcfg_parse_file_from(gcfg_file_t *file, const gcfg_keyword_t *keywords,
+			 void *usr, unsigned long linenum)
+{
+	gcfg_block_t stack[GCFG_DEFAULT_MAX_DEPTH];
+
+	return parse_file(file, keywords, usr, stack, GCFG_DEFAULT_MAX_DEPTH,
+			  0, linenum);
+}
+
 int gcfg_parse_file(gcfg_file_t *file, const gcfg_keyword_t *keywords,
 		    void *usr)
 {
-	return parse(file, keywords, usr, 0);
+	gcfg_block_t stack[GCFG_DEFAULT_MAX_DEPTH];
+
+	return gcfg_parse_file_depth(file, keywords, usr, stack,
+				     GCFG_DEFAULT_MAX_DEPTH);
 }
@@ -0,0 +1,594 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * parse_parallel.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+
+/* top-level declarations are grouped into chunks of at least this size */
+#define CHUNK_TARGET (65536)
+
+/* chunks parsed ahead of the one delivered, per worker */
+#define CHUNK_WINDOW (4)
+
+enum {
+	CHUNK_PENDING = 0,
+	CHUNK_DONE,
+	CHUNK_FAILED,
+};
+
+typedef struct {
+	size_t offset;
+	size_t size;
+
+	/* number of lines before the chunk */
+	unsigned long line;
+
+	gcfg_document_t *doc;
+	int state;
+} chunk_t;
+
+/*
+  Workers take chunks in order. In the default mode, they parse each chunk
+  into a document, which the calling thread replays through the keyword
+  callbacks in order. If a chunk fails, everything from its start on is
+  parsed again on the calling thread, to report the error exactly as
+  gcfg_parse_file would.
+*/
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	const char *path;
+	const char *data;
+	size_t size;
+
+	const gcfg_keyword_t *keywords;
+	void *usr;
+	uint32_t flags;
+
+	chunk_t *chunks;
+	size_t count;
+	size_t max;
+
+	/* next chunk to parse and number of chunks replayed so far */
+	size_t next;
+	size_t delivered;
+	size_t window;
+
+	bool quit;
+
+	/* values of a batch keyword, while replaying them */
+	gcfg_value_t *batch;
+	size_t batch_max;
+} parallel_t;
+
+static GCFG_PRINTF_FUN(2, 3) void discard_error(gcfg_file_t *file,
+						const char *msg, ...)
+{
+	(void)file; (void)msg;
+}
+
+static gcfg_file_t *open_chunk(parallel_t *p, const chunk_t *chunk,
+			       size_t size)
+{
+	gcfg_file_t *file;
+
+	file = gcfg_file_open_memory(p->path, p->data + chunk->offset, size);
+	if (file == NULL)
+		return NULL;
+
+	((gcfg_stdio_file_t *)file)->linenum = chunk->line;
+	return file;
+}
+
+static int add_chunk(parallel_t *p, size_t offset, size_t size,
+		     unsigned long line)
+{
+	chunk_t *new;
+	size_t max;
+
+	if (p->count == p->max) {
+		max = p->max ? p->max * 2 : 64;
+
+		new = realloc(p->chunks, max * sizeof(new[0]));
+		if (new == NULL)
+			return -1;
+
+		p->chunks = new;
+		p->max = max;
+	}
+
+	new = p->chunks + p->count++;
+	memset(new, 0, sizeof(*new));
+	new->offset = offset;
+	new->size = size;
+	new->line = line;
+	return 0;
+}
+
+static int split_input(parallel_t *p)
+{
+	size_t offset = 0, start = 0;
+	unsigned long lines = 0, first = 0;
+
+	while (offset < p->size) {
+		offset += gcfg_scan_declaration(p->data + offset,
+						p->size - offset,
+						p->keywords, &lines);
+
+		if (offset - start >= CHUNK_TARGET || offset == p->size) {
+			if (add_chunk(p, start, offset - start, first))
+				return -1;
+
+			start = offset;
+			first = lines;
+		}
+	}
+
+	return 0;
+}
+
+static int parse_chunk(parallel_t *p, chunk_t *chunk)
+{
+	gcfg_file_t *file;
+	int ret = 0;
+
+	file = open_chunk(p, chunk, chunk->size);
+	if (file == NULL)
+		return -1;
+
+	if (p->flags & GCFG_PARALLEL_UNORDERED) {
+		ret = gcfg_parse_file_from(file, p->keywords, p->usr,
+					   chunk->line);
+	} else {
+		/* errors are reported when parsing the chunk again */
+		file->report_error = discard_error;
+
+		chunk->doc = gcfg_parse_document(file, p->keywords);
+		if (chunk->doc == NULL)
+			ret = -1;
+	}
+
+	gcfg_file_close(file);
+	return ret;
+}
+
+static void *worker(void *arg)
+{
+	parallel_t *p = arg;
+	chunk_t *chunk;
+	int ret;
+
+	pthread_mutex_lock(&p->lock);
+
+	for (;;) {
+		while (!p->quit && p->next < p->count &&
+		       p->next >= p->delivered + p->window) {
+			pthread_cond_wait(&p->cond, &p->lock);
+		}
+
+		if (p->quit || p->next >= p->count)
+			break;
+
+		chunk = p->chunks + p->next++;
+		pthread_mutex_unlock(&p->lock);
+
+		ret = parse_chunk(p, chunk);
+
+		pthread_mutex_lock(&p->lock);
+		chunk->state = ret == 0 ? CHUNK_DONE : CHUNK_FAILED;
+
+		if (ret != 0 && (p->flags & GCFG_PARALLEL_UNORDERED))
+			p->quit = true;
+
+		pthread_cond_broadcast(&p->cond);
+	}
+
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+static int close_listing(gcfg_file_t *file, const gcfg_keyword_t *kwd,
+			 void *object, const char *line)
+{
+	if (line == NULL || kwd->handle_listing(file, object, line) <= 0) {
+		file->report_error(file, "missing '}' after listing");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+  Returns the number of lines in the body of a deferred block that starts
+  with the given line of a chunk. The documents do not record where blocks
+  end, so the source is scanned again. Blocks are found in the order of the
+  input, the position of the last one is kept in *offset and *line.
+*/
+static unsigned long deferred_lines(const parallel_t *p, const chunk_t *chunk,
+				    const gcfg_keyword_t *list,
+				    unsigned long target, size_t *offset,
+				    unsigned long *line)
+{
+	const char *data = p->data + chunk->offset, *ptr;
+	unsigned long lines = 0;
+
+	while (*line < target) {
+		ptr = memchr(data + *offset, '\n', chunk->size - *offset);
+		if (ptr == NULL)
+			break;
+
+		*offset = (size_t)(ptr - data) + 1;
+		*line += 1;
+	}
+
+	gcfg_scan_declaration(data + *offset, chunk->size - *offset, list,
+			      &lines);
+	return lines - 1;
+}
+
+/*
+  Delivers the value of a node with GCFG_KEYWORD_BATCH, along with those of
+  the siblings of the same keyword that directly follow it, and advances
+  *idx past them. The strings stay in the document, so no copies are made.
+*/
+static int replay_batch(parallel_t *p, gcfg_file_t *file,
+			const gcfg_document_t *doc, const gcfg_keyword_t *kwd,
+			const gcfg_node_t *node, void *parent, uint32_t *idx)
+{
+	const gcfg_node_t *next;
+	size_t count = 0, max;
+	gcfg_value_t *new;
+
+	for (;;) {
+		if (count == p->batch_max) {
+			max = p->batch_max ? p->batch_max * 2 : 64;
+
+			new = realloc(p->batch, max * sizeof(new[0]));
+			if (new == NULL) {
+				file->report_error(file, "out of memory");
+				return -1;
+			}
+
+			p->batch = new;
+			p->batch_max = max;
+		}
+
+		gcfg_node_get_value(doc, node, p->batch + count++);
+
+		if (*idx == 0)
+			break;
+
+		next = doc->nodes + *idx;
+		if (next->type != GCFG_NODE_KEYWORD ||
+		    next->keyword != node->keyword) {
+			break;
+		}
+
+		node = next;
+		*idx = node->next;
+	}
+
+	if (kwd->handle_batch == NULL)
+		return 0;
+
+	return kwd->handle_batch(file, parent, p->batch, count);
+}
+
+/* calls the keyword callbacks for a document, in the order of the input */
+static int replay(parallel_t *p, gcfg_file_t *file, const chunk_t *chunk)
+{
+	struct {
+		const gcfg_keyword_t *kwd;
+		const gcfg_node_t *node;
+		void *object;
+		uint32_t next;
+	} stack[GCFG_DEFAULT_MAX_DEPTH];
+	const gcfg_document_t *doc = chunk->doc;
+	const gcfg_keyword_t *list = p->keywords, *kwd;
+	const gcfg_node_t *node;
+	void *parent = p->usr, *child;
+	const char *str;
+	uint32_t idx = doc->nodes[0].child;
+	size_t depth = 0, offset = 0;
+	unsigned long line = 1;
+	gcfg_deferred_t body;
+	gcfg_value_t val;
+	int ret;
+
+	for (;;) {
+		while (idx == 0) {
+			if (depth == 0)
+				return 0;
+
+			depth -= 1;
+			kwd = stack[depth].kwd;
+			node = stack[depth].node;
+
+			((gcfg_stdio_file_t *)file)->linenum =
+				chunk->line + node->end_line;
+
+			if (kwd->handle_listing != NULL &&
+			    close_listing(file, kwd, stack[depth].object,
+					  gcfg_document_string(doc,
+							       node->end))) {
+				return -1;
+			}
+
+			if (kwd->finalize_object != NULL &&
+			    kwd->finalize_object(file, stack[depth].object)) {
+				return -1;
+			}
+
+			idx = stack[depth].next;
+
+			if (depth == 0) {
+				list = p->keywords;
+				parent = p->usr;
+			} else {
+				list = stack[depth - 1].kwd->children;
+				parent = stack[depth - 1].object;
+			}
+		}
+
+		node = doc->nodes + idx;
+		((gcfg_stdio_file_t *)file)->linenum = chunk->line + node->line;
+		idx = node->next;
+
+		if (node->type == GCFG_NODE_LISTING_LINE) {
+			/* listing lines are never at the top level */
+			if (depth == 0)
+				return -1;
+
+			kwd = stack[depth - 1].kwd;
+			str = gcfg_document_string(doc, node->name);
+
+			ret = kwd->handle_listing(file, parent, str);
+			if (ret < 0)
+				return -1;
+			if (ret > 0) {
+				file->report_error(file, "missing '}' after "
+						   "listing");
+				return -1;
+			}
+			continue;
+		}
+
+		kwd = list + node->keyword;
+
+		if (node->type == GCFG_NODE_KEYWORD &&
+		    (kwd->flags & GCFG_KEYWORD_BATCH)) {
+			if (replay_batch(p, file, doc, kwd, node, parent, &idx))
+				return -1;
+			continue;
+		}
+
+		gcfg_node_get_value(doc, node, &val);
+
+		child = kwd->set_property(file, parent, &val);
+		if (child == NULL)
+			return -1;
+
+		if (node->type == GCFG_NODE_BLOCK &&
+		    (kwd->flags & GCFG_KEYWORD_DEFERRED) &&
+		    kwd->handle_listing == NULL) {
+			body.keyword = kwd;
+			body.line = chunk->line + node->line + 1;
+			body.count = deferred_lines(p, chunk, list, node->line,
+						    &offset, &line);
+
+			if (kwd->handle_deferred != NULL &&
+			    kwd->handle_deferred(file, child, &body)) {
+				return -1;
+			}
+		} else if (node->type == GCFG_NODE_BLOCK) {
+			stack[depth].kwd = kwd;
+			stack[depth].node = node;
+			stack[depth].object = child;
+			stack[depth].next = idx;
+			depth += 1;
+
+			list = kwd->children;
+			parent = child;
+			idx = node->child;
+			continue;
+		}
+
+		if (kwd->finalize_object != NULL &&
+		    kwd->finalize_object(file, child)) {
+			return -1;
+		}
+	}
+}
+
+/* parses the rest of the input sequentially, starting at a chunk */
+static int parse_rest(parallel_t *p, const chunk_t *chunk)
+{
+	gcfg_file_t *file;
+	int ret;
+
+	file = open_chunk(p, chunk, p->size - chunk->offset);
+	if (file == NULL)
+		return -1;
+
+	ret = gcfg_parse_file_from(file, p->keywords, p->usr, chunk->line);
+	gcfg_file_close(file);
+	return ret;
+}
+
+static int deliver(parallel_t *p)
+{
+	gcfg_file_t *file;
+	chunk_t *chunk;
+	size_t i;
+	int ret = 0;
+
+	/* only used to attribute errors from callbacks to lines */
+	file = gcfg_file_open_memory(p->path, p->data, 0);
+	if (file == NULL)
+		return -1;
+
+	for (i = 0; i < p->count; ++i) {
+		chunk = p->chunks + i;
+
+		pthread_mutex_lock(&p->lock);
+		while (chunk->state == CHUNK_PENDING)
+			pthread_cond_wait(&p->cond, &p->lock);
+		pthread_mutex_unlock(&p->lock);
+
+		if (chunk->state == CHUNK_FAILED) {
+			pthread_mutex_lock(&p->lock);
+			p->quit = true;
+			pthread_cond_broadcast(&p->cond);
+			pthread_mutex_unlock(&p->lock);
+
+			ret = parse_rest(p, chunk);
+			break;
+		}
+
+		ret = replay(p, file, chunk);
+
+		gcfg_document_free(chunk->doc);
+		chunk->doc = NULL;
+
+		if (ret != 0)
+			break;
+
+		pthread_mutex_lock(&p->lock);
+		p->delivered += 1;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	gcfg_file_close(file);
+	return ret;
+}
+
+static int run(parallel_t *p, unsigned int threads)
+{
+	pthread_t *tids;
+	unsigned int i;
+	size_t j;
+	int ret;
+
+	tids = calloc(threads, sizeof(tids[0]));
+	if (tids == NULL)
+		goto fail_errno;
+
+	for (i = 0; i < threads; ++i) {
+		ret = pthread_create(tids + i, NULL, worker, p);
+		if (ret != 0) {
+			errno = ret;
+			break;
+		}
+	}
+
+	if (i == 0) {
+		free(tids);
+		goto fail_errno;
+	}
+
+	threads = i;
+
+	/* without ordering, the workers simply run out of chunks */
+	ret = 0;
+
+	if (!(p->flags & GCFG_PARALLEL_UNORDERED)) {
+		ret = deliver(p);
+
+		pthread_mutex_lock(&p->lock);
+		p->quit = true;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	for (i = 0; i < threads; ++i)
+		pthread_join(tids[i], NULL);
+
+	free(tids);
+
+	/* in order, a failed chunk was already parsed again by deliver */
+	for (j = 0; j < p->count; ++j) {
+		if (p->chunks[j].state == CHUNK_FAILED &&
+		    (p->flags & GCFG_PARALLEL_UNORDERED)) {
+			ret = -1;
+		}
+		if (p->chunks[j].doc != NULL)
+			gcfg_document_free(p->chunks[j].doc);
+	}
+
+	return ret;
+fail_errno:
+	dprintf(STDERR_FILENO, "%s: %s\n", p->path, strerror(errno));
+	return -1;
+}
+
+int gcfg_parse_path_parallel(const char *path, const gcfg_keyword_t *keywords,
+			     void *usr, unsigned int threads, uint32_t flags)
+{
+	char *data = NULL;
+	parallel_t p;
+	long cpus;
+	int fd, ret;
+
+	memset(&p, 0, sizeof(p));
+	p.path = path;
+	p.keywords = keywords;
+	p.usr = usr;
+	p.flags = flags;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		goto fail_errno;
+
+	data = gcfg_read_fd(fd, &p.size);
+	close(fd);
+
+	if (data == NULL)
+		goto fail_errno;
+
+	p.data = data;
+
+	if (split_input(&p)) {
+		dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+		ret = -1;
+		goto out;
+	}
+
+	if (threads == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (unsigned int)cpus : 1;
+	}
+
+	if (threads > p.count)
+		threads = p.count > 0 ? (unsigned int)p.count : 1;
+
+	p.window = (p.flags & GCFG_PARALLEL_UNORDERED) ? p.count :
+		threads * CHUNK_WINDOW;
+
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.cond, NULL);
+
+	ret = run(&p, threads);
+
+	pthread_cond_destroy(&p.cond);
+	pthread_mutex_destroy(&p.lock);
+out:
+	free(data);
+	free(p.chunks);
+	free(p.batch);
+	return ret;
+fail_errno:
+	dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+	return -1;
+}
@@ -0,0 +1,180 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * parse_recover.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+
+/*
+  Stands in for the file while parsing, so errors reported through it end up
+  in the diagnostics. Reads lines from the wrapped file.
+*/
+typedef struct {
+	gcfg_file_t base;
+	gcfg_file_t *file;
+
+	const gcfg_parse_ctx_t *ctx;
+	gcfg_diagnostic_t *diag;
+	size_t count;
+	size_t max;
+} recover_t;
+
+static GCFG_PRINTF_FUN(2, 3) void record_error(gcfg_file_t *file,
+					       const char *msg, ...)
+{
+	recover_t *rec = (recover_t *)file;
+	gcfg_diagnostic_t *diag;
+	va_list ap;
+
+	if (rec->count >= rec->max)
+		return;
+
+	diag = rec->diag + rec->count++;
+	diag->line = rec->ctx->linenum;
+	diag->column = rec->ctx->column;
+	diag->code = rec->ctx->error;
+
+	va_start(ap, msg);
+	vsnprintf(diag->message, sizeof(diag->message), msg, ap);
+	va_end(ap);
+}
+
+static int fetch_line(gcfg_file_t *file)
+{
+	recover_t *rec = (recover_t *)file;
+	int ret;
+
+	ret = rec->file->fetch_line(rec->file);
+	file->buffer = rec->file->buffer;
+	return ret;
+}
+
+static int fetch_lines(gcfg_file_t *file)
+{
+	recover_t *rec = (recover_t *)file;
+	int ret;
+
+	rec->file->line_index = file->line_index;
+
+	ret = rec->file->fetch_lines(rec->file);
+	file->buffer = rec->file->buffer;
+	file->lines = rec->file->lines;
+	file->line_count = rec->file->line_count;
+	file->line_index = rec->file->line_index;
+	return ret;
+}
+
+/*
+  Returns > 0 if the block opened by the failed step has to be skipped, 0 if
+  parsing can continue with the next line, < 0 if it has to stop.
+*/
+static int failed(recover_t *rec, gcfg_parse_ctx_t *ctx, size_t first,
+		  const gcfg_event_t *ev, bool skip)
+{
+	/* callbacks may fail without saying why */
+	if (rec->count == first && ctx->error == GCFG_DIAG_CALLBACK) {
+		record_error(&rec->base, "'%s' rejected",
+			     ev->keyword->name);
+	}
+
+	if (ctx->error == 0 || ctx->eof || rec->count >= rec->max)
+		return -1;
+
+	return skip ? 1 : 0;
+}
+
+int gcfg_parse_file_recover(gcfg_file_t *file, const gcfg_keyword_t *keywords,
+			    void *usr, gcfg_diagnostic_t *diag, size_t max,
+			    size_t *count)
+{
+	gcfg_block_t stack[GCFG_DEFAULT_MAX_DEPTH];
+	bool have_errors = false;
+	const gcfg_keyword_t *kwd;
+	gcfg_parse_ctx_t ctx;
+	gcfg_event_t ev;
+	size_t depth, first;
+	unsigned long line;
+	recover_t rec;
+	int ret;
+
+	*count = 0;
+
+	if (gcfg_parse_ctx_init(&ctx, keywords, usr, stack,
+				GCFG_DEFAULT_MAX_DEPTH)) {
+		file->report_error(file, "out of memory");
+		return -1;
+	}
+
+	ctx.recover = true;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.base.report_error = record_error;
+	rec.base.fetch_line = fetch_line;
+	rec.base.buffer = file->buffer;
+	rec.base.fetch_lines = file->fetch_lines == NULL ? NULL : fetch_lines;
+	rec.base.lines = file->lines;
+	rec.base.line_count = file->line_count;
+	rec.base.line_index = file->line_index;
+	rec.file = file;
+	rec.ctx = &ctx;
+	rec.diag = diag;
+	rec.max = max;
+
+	for (;;) {
+		first = rec.count;
+
+		ret = gcfg_next_event(&rec.base, &ctx, &ev);
+		if (ret > 0) {
+			kwd = ctx.batch.keyword;
+
+			/* the values of a batch are delivered at the end */
+			if (gcfg_batch_flush(&rec.base, &ctx)) {
+				if (rec.count == first) {
+					record_error(&rec.base, "'%s' rejected",
+						     kwd->name);
+				}
+				have_errors = true;
+			}
+			break;
+		}
+
+		if (ret == 0) {
+			depth = ctx.depth;
+			line = ctx.linenum;
+
+			if (gcfg_apply_event(&rec.base, &ctx, &ev) == 0)
+				continue;
+
+			/* a deferred block may already have been skipped */
+			ret = failed(&rec, &ctx, first, &ev,
+				     ev.type == GCFG_EVENT_BEGIN_BLOCK &&
+				     ctx.depth == depth && ctx.linenum == line);
+		} else {
+			ret = failed(&rec, &ctx, first, &ev, ctx.opens_block);
+		}
+
+		have_errors = true;
+
+		if (ret > 0) {
+			first = rec.count;
+
+			if (gcfg_skip_block(&rec.base, &ctx))
+				ret = failed(&rec, &ctx, first, &ev, false);
+		}
+
+		if (ret < 0)
+			break;
+	}
+
+	file->buffer = rec.base.buffer;
+	file->line_index = rec.base.line_index;
+	gcfg_parse_ctx_cleanup(&ctx);
+
+	*count = rec.count;
+	return have_errors ? -1 : 0;
+}
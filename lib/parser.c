@@ -0,0 +1,148 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * parser.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/*
+  The input is read through a stdio file, which already keeps the partial
+  line at the end of its buffer around until the rest of it arrives. Its
+  read hook hands out the data passed to gcfg_parser_feed and reports
+  GCFG_READ_AGAIN once that is used up.
+*/
+struct gcfg_parser_t {
+	gcfg_parse_ctx_t ctx;
+	gcfg_stdio_file_t *file;
+
+	const char *data;
+	size_t size;
+
+	bool finished;
+	bool failed;
+};
+
+#ifdef GCFG_DISABLE_ALLOC
+static gcfg_parser_t static_parser;
+static gcfg_block_t static_stack[GCFG_DEFAULT_MAX_DEPTH];
+static bool have_parser = false;
+#endif
+
+static ssize_t read_fed(gcfg_stdio_file_t *file, char *dst, size_t size)
+{
+	gcfg_parser_t *parser = file->priv;
+
+	if (parser->size == 0)
+		return parser->finished ? 0 : GCFG_READ_AGAIN;
+
+	if (size > parser->size)
+		size = parser->size;
+
+	memcpy(dst, parser->data, size);
+	parser->data += size;
+	parser->size -= size;
+	return (ssize_t)size;
+}
+
+static int parse(gcfg_parser_t *parser)
+{
+	if (parser->failed)
+		return -1;
+
+	if (gcfg_parse_events((gcfg_file_t *)parser->file, &parser->ctx)) {
+		parser->failed = true;
+		return -1;
+	}
+
+	return 0;
+}
+
+gcfg_parser_t *gcfg_parser_create(const char *name,
+				  const gcfg_keyword_t *keywords, void *usr,
+				  size_t max_depth)
+{
+	gcfg_stdio_file_t *file;
+	gcfg_parser_t *parser;
+
+	file = gcfg_stdio_file_create(name);
+	if (file == NULL)
+		return NULL;
+
+#ifdef GCFG_DISABLE_ALLOC
+	if (have_parser || max_depth > GCFG_DEFAULT_MAX_DEPTH) {
+		file->base.report_error((gcfg_file_t *)file,
+					"cannot create parser");
+		gcfg_file_close((gcfg_file_t *)file);
+		return NULL;
+	}
+
+	parser = &static_parser;
+	memset(parser, 0, sizeof(*parser));
+	gcfg_parse_ctx_init(&parser->ctx, keywords, usr, static_stack,
+			    max_depth);
+	have_parser = true;
+#else
+	parser = calloc(1, sizeof(*parser));
+	if (parser == NULL)
+		goto fail;
+
+	if (gcfg_parse_ctx_init(&parser->ctx, keywords, usr, NULL,
+				max_depth)) {
+		free(parser);
+		goto fail;
+	}
+#endif
+	parser->ctx.incomplete = true;
+	parser->ctx.no_defer = true;
+	parser->file = file;
+
+	file->read = read_fed;
+	file->priv = parser;
+	return parser;
+#ifndef GCFG_DISABLE_ALLOC
+fail:
+	file->base.report_error((gcfg_file_t *)file, "out of memory");
+	gcfg_file_close((gcfg_file_t *)file);
+	return NULL;
+#endif
+}
+
+int gcfg_parser_feed(gcfg_parser_t *parser, const void *data, size_t size)
+{
+	if (parser->finished) {
+		parser->file->base.report_error((gcfg_file_t *)parser->file,
+						"data after end of input");
+		parser->failed = true;
+		return -1;
+	}
+
+	parser->data = data;
+	parser->size = size;
+
+	/* the file copies everything it has not consumed into its buffer */
+	return parse(parser);
+}
+
+int gcfg_parser_finish(gcfg_parser_t *parser)
+{
+	parser->finished = true;
+	parser->ctx.incomplete = false;
+	parser->data = NULL;
+	parser->size = 0;
+	return parse(parser);
+}
+
+void gcfg_parser_destroy(gcfg_parser_t *parser)
+{
+	gcfg_file_close((gcfg_file_t *)parser->file);
+	gcfg_parse_ctx_cleanup(&parser->ctx);
+#ifdef GCFG_DISABLE_ALLOC
+	have_parser = false;
+#else
+	free(parser);
+#endif
+}
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * reader.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <stdlib.h>
+
+struct gcfg_reader_t {
+	gcfg_parse_ctx_t ctx;
+	gcfg_file_t *file;
+};
+
+#ifdef GCFG_DISABLE_ALLOC
+static gcfg_reader_t static_reader;
+static gcfg_block_t static_stack[GCFG_DEFAULT_MAX_DEPTH];
+static bool have_reader = false;
+#endif
+
+gcfg_reader_t *gcfg_reader_create(gcfg_file_t *file,
+				  const gcfg_keyword_t *keywords,
+				  size_t max_depth)
+{
+	gcfg_reader_t *rd;
+
+#ifdef GCFG_DISABLE_ALLOC
+	if (have_reader) {
+		file->report_error(file, "too many open gcfg readers");
+		return NULL;
+	}
+
+	if (max_depth > GCFG_DEFAULT_MAX_DEPTH) {
+		file->report_error(file, "reader nesting depth too large "
+				   "(maximum is %lu)",
+				   (unsigned long)GCFG_DEFAULT_MAX_DEPTH);
+		return NULL;
+	}
+
+	rd = &static_reader;
+	gcfg_parse_ctx_init(&rd->ctx, keywords, NULL, static_stack,
+			    max_depth);
+	have_reader = true;
+#else
+	rd = calloc(1, sizeof(*rd));
+	if (rd == NULL)
+		goto fail;
+
+	if (gcfg_parse_ctx_init(&rd->ctx, keywords, NULL, NULL, max_depth)) {
+		free(rd);
+		goto fail;
+	}
+#endif
+	rd->file = file;
+	return rd;
+#ifndef GCFG_DISABLE_ALLOC
+fail:
+	file->report_error(file, "out of memory");
+	return NULL;
+#endif
+}
+
+int gcfg_reader_next(gcfg_reader_t *rd, gcfg_event_t *ev)
+{
+	int ret;
+
+	ret = gcfg_next_event(rd->file, &rd->ctx, ev);
+	if (ret != 0)
+		return ret;
+
+	return gcfg_track_event(rd->file, &rd->ctx, ev);
+}
+
+void gcfg_reader_destroy(gcfg_reader_t *rd)
+{
+	gcfg_parse_ctx_cleanup(&rd->ctx);
+#ifdef GCFG_DISABLE_ALLOC
+	have_reader = false;
+#else
+	free(rd);
+#endif
+}
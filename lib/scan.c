@@ -0,0 +1,147 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * scan.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <string.h>
+
+static bool is_space(int c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* returns true if the line ends with a '{' outside of strings and comments */
+static bool opens_block(const char *line, const char *end)
+{
+	bool quoted = false, brace = false;
+	const char *last = end;
+
+	/* without a comment, a '{' at the end cannot be part of a string */
+	if (memchr(line, '#', (size_t)(end - line)) == NULL) {
+		while (last > line && is_space(last[-1]))
+			--last;
+		return last > line && last[-1] == '{';
+	}
+
+	for (; line < end; ++line) {
+		if (quoted) {
+			if (*line == '\\' && (line + 1) < end) {
+				++line;
+			} else if (*line == '"') {
+				quoted = false;
+			}
+			continue;
+		}
+
+		if (*line == '#')
+			break;
+
+		if (*line == '"') {
+			quoted = true;
+			brace = false;
+		} else if (!is_space(*line)) {
+			brace = (*line == '{');
+		}
+	}
+
+	return brace;
+}
+
+bool gcfg_line_opens_block(const char *line, size_t length)
+{
+	return opens_block(line, line + length);
+}
+
+/* same first-match rule as the parser, but also accepts "name{" */
+static const gcfg_keyword_t *find_keyword(const gcfg_keyword_t *list,
+					  const char *line, const char *end)
+{
+	size_t len;
+
+	if (list == NULL)
+		return NULL;
+
+	for (; list->name != NULL; ++list) {
+		len = strlen(list->name);
+
+		if ((size_t)(end - line) < len ||
+		    strncmp(line, list->name, len) != 0) {
+			continue;
+		}
+
+		if (line + len == end || is_space(line[len]) ||
+		    line[len] == '{' || line[len] == '#') {
+			return list;
+		}
+	}
+
+	return NULL;
+}
+
+size_t gcfg_scan_declaration(const char *data, size_t size,
+			     const gcfg_keyword_t *keywords,
+			     unsigned long *lines)
+{
+	const gcfg_keyword_t *lists[GCFG_DEFAULT_MAX_DEPTH + 1];
+	const char *line = data, *end, *next = data, *stop = data + size;
+	const gcfg_keyword_t *kwd;
+	bool listing = false;
+	size_t depth = 0;
+
+	lists[0] = keywords;
+
+	for (; line < stop; line = next) {
+		end = memchr(line, '\n', (size_t)(stop - line));
+		next = end == NULL ? stop : end + 1;
+		if (end == NULL)
+			end = stop;
+
+		*lines += 1;
+
+		while (line < end && is_space(*line))
+			++line;
+
+		if (line < end && *line == '}') {
+			if (listing) {
+				/* listings only end at a line with just '}' */
+				++line;
+				while (line < end && is_space(*line))
+					++line;
+				if (line != end)
+					continue;
+				listing = false;
+			}
+
+			if (depth <= 1)
+				break;
+
+			depth -= 1;
+			continue;
+		}
+
+		if (listing)
+			continue;
+
+		if (!opens_block(line, end)) {
+			if (depth == 0)
+				break;
+			continue;
+		}
+
+		kwd = NULL;
+		if (depth <= GCFG_DEFAULT_MAX_DEPTH)
+			kwd = find_keyword(lists[depth], line, end);
+
+		depth += 1;
+
+		if (depth <= GCFG_DEFAULT_MAX_DEPTH)
+			lists[depth] = kwd == NULL ? NULL : kwd->children;
+
+		listing = kwd != NULL && kwd->handle_listing != NULL;
+	}
+
+	return (size_t)(next - data);
+}
@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * scan_block.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <string.h>
+
+#ifdef GCFG_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define BYTES(x) ((~(uint64_t)0 / 255) * (x))
+
+/* sets the high bit of every byte of w that is zero, without carries */
+static uint64_t zero_bytes(uint64_t w)
+{
+	return ~(((w & BYTES(0x7F)) + BYTES(0x7F)) | w | BYTES(0x7F));
+}
+
+/* gathers the high bits of the bytes of w, like _mm_movemask_epi8 */
+static uint64_t high_bits(uint64_t w)
+{
+	return ((w >> 7) * 0x0102040810204080UL) >> 56;
+}
+
+void gcfg_scan_block_swar(const char *data, gcfg_block_bits_t *out)
+{
+	uint64_t w, nl, cr, tab, other;
+	size_t i;
+
+	memset(out, 0, sizeof(*out));
+
+	for (i = 0; i < 64; i += 8) {
+		memcpy(&w, data + i, sizeof(w));
+
+		nl = zero_bytes(w ^ BYTES('\n'));
+		cr = zero_bytes(w ^ BYTES('\r'));
+		tab = zero_bytes(w ^ BYTES('\t'));
+
+		/* bytes < 0x20 or >= 0x7F */
+		other = ~(((w & BYTES(0x7F)) + BYTES(0x60)) | w);
+		other = (other | w | zero_bytes(w ^ BYTES(0x7F))) &
+			~(nl | cr | tab) & BYTES(0x80);
+
+		out->newline |= high_bits(nl) << i;
+		out->cr |= high_bits(cr) << i;
+		out->other |= high_bits(other) << i;
+	}
+}
+
+#ifdef GCFG_HAVE_X86_SIMD
+__attribute__((target("sse2")))
+void gcfg_scan_block_sse2(const char *data, gcfg_block_bits_t *out)
+{
+	const __m128i ctrl = _mm_set1_epi8(0x1F);
+	const __m128i del = _mm_set1_epi8(0x7F);
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	__m128i v, is_lf, is_cr, ok;
+	size_t i;
+
+	memset(out, 0, sizeof(*out));
+
+	for (i = 0; i < 64; i += 16) {
+		v = _mm_loadu_si128((const void *)(data + i));
+
+		is_lf = _mm_cmpeq_epi8(v, lf);
+		is_cr = _mm_cmpeq_epi8(v, cr);
+
+		/* bytes >= 0x80 are negative, i.e. less than 0x1F */
+		ok = _mm_andnot_si128(_mm_cmpeq_epi8(v, del),
+				      _mm_cmpgt_epi8(v, ctrl));
+		ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, tab));
+		ok = _mm_or_si128(ok, _mm_or_si128(is_lf, is_cr));
+
+		out->newline |= (uint64_t)(unsigned int)
+			_mm_movemask_epi8(is_lf) << i;
+		out->cr |= (uint64_t)(unsigned int)
+			_mm_movemask_epi8(is_cr) << i;
+		out->other |= (uint64_t)(~(unsigned int)
+			_mm_movemask_epi8(ok) & 0xFFFF) << i;
+	}
+}
+
+__attribute__((target("avx2")))
+void gcfg_scan_block_avx2(const char *data, gcfg_block_bits_t *out)
+{
+	const __m256i ctrl = _mm256_set1_epi8(0x1F);
+	const __m256i del = _mm256_set1_epi8(0x7F);
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i cr = _mm256_set1_epi8('\r');
+	__m256i v, is_lf, is_cr, ok;
+	size_t i;
+
+	memset(out, 0, sizeof(*out));
+
+	for (i = 0; i < 64; i += 32) {
+		v = _mm256_loadu_si256((const void *)(data + i));
+
+		is_lf = _mm256_cmpeq_epi8(v, lf);
+		is_cr = _mm256_cmpeq_epi8(v, cr);
+
+		ok = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, del),
+					 _mm256_cmpgt_epi8(v, ctrl));
+		ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, tab));
+		ok = _mm256_or_si256(ok, _mm256_or_si256(is_lf, is_cr));
+
+		out->newline |= (uint64_t)(unsigned int)
+			_mm256_movemask_epi8(is_lf) << i;
+		out->cr |= (uint64_t)(unsigned int)
+			_mm256_movemask_epi8(is_cr) << i;
+		out->other |= (uint64_t)(~(unsigned int)
+			_mm256_movemask_epi8(ok)) << i;
+	}
+}
+#endif
+
+void gcfg_scan_block(const char *data, gcfg_block_bits_t *out)
+{
+#ifdef GCFG_HAVE_X86_SIMD
+	if (__builtin_cpu_supports("avx2")) {
+		gcfg_scan_block_avx2(data, out);
+		return;
+	}
+
+	if (__builtin_cpu_supports("sse2")) {
+		gcfg_scan_block_sse2(data, out);
+		return;
+	}
+#endif
+	gcfg_scan_block_swar(data, out);
+}
@@ -0,0 +1,427 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * tracker.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+
+enum {
+	DECL_UNCHANGED = 0,
+	DECL_ADDED,
+	DECL_CHANGED,
+};
+
+typedef struct {
+	/* hash of the whole source text of the declaration */
+	uint64_t hash;
+
+	/* offset of the first line in the key pool */
+	size_t key;
+
+	/* next entry with the same first line, plus one */
+	size_t dup;
+
+	/* location in the input, only used during an update */
+	size_t offset;
+	size_t size;
+	unsigned long line;
+
+	/* the paired declaration of the previous generation, plus one */
+	size_t match;
+
+	int state;
+	bool matched;
+
+	/* the change callback was called for it during this update */
+	bool reported;
+
+	/* callbacks may have only seen part of it, it never counts as
+	   unchanged */
+	bool dirty;
+} decl_t;
+
+typedef struct {
+	decl_t *decls;
+	size_t count;
+	size_t max;
+
+	char *keys;
+	size_t keys_used;
+	size_t keys_max;
+} generation_t;
+
+struct gcfg_tracker_t {
+	const gcfg_keyword_t *keywords;
+
+	int (*change)(void *usr, int type, const char *line);
+
+	/* the declarations as the callbacks have seen them so far */
+	generation_t gen;
+};
+
+static void generation_cleanup(generation_t *gen)
+{
+	free(gen->decls);
+	free(gen->keys);
+	memset(gen, 0, sizeof(*gen));
+}
+
+/* appends a declaration identified by the len bytes at key */
+static decl_t *push_decl(generation_t *gen, const char *key, size_t len)
+{
+	decl_t *decl;
+	size_t max;
+	void *new;
+
+	if (gen->count == gen->max) {
+		max = gen->max ? gen->max * 2 : 64;
+
+		new = realloc(gen->decls, max * sizeof(gen->decls[0]));
+		if (new == NULL)
+			return NULL;
+
+		gen->decls = new;
+		gen->max = max;
+	}
+
+	if (gen->keys == NULL || gen->keys_max - gen->keys_used < len + 1) {
+		max = gen->keys_max ? gen->keys_max : 4096;
+		while (max - gen->keys_used < len + 1)
+			max *= 2;
+
+		new = realloc(gen->keys, max);
+		if (new == NULL)
+			return NULL;
+
+		gen->keys = new;
+		gen->keys_max = max;
+	}
+
+	decl = gen->decls + gen->count++;
+	memset(decl, 0, sizeof(*decl));
+	decl->key = gen->keys_used;
+
+	memcpy(gen->keys + gen->keys_used, key, len);
+	gen->keys[gen->keys_used + len] = '\0';
+	gen->keys_used += len + 1;
+	return decl;
+}
+
+static int add_decl(generation_t *gen, const char *data, size_t offset,
+		    size_t size, unsigned long line)
+{
+	const char *key = data + offset, *end;
+	decl_t *decl;
+
+	/* the first line, without surrounding space, identifies it */
+	end = memchr(key, '\n', size);
+	if (end == NULL)
+		end = key + size;
+
+	while (key < end && (*key == ' ' || *key == '\t'))
+		++key;
+	while (end > key && (end[-1] == ' ' || end[-1] == '\t' ||
+			     end[-1] == '\r')) {
+		--end;
+	}
+
+	/* blank lines and comments between declarations */
+	if (key == end || *key == '#')
+		return 0;
+
+	decl = push_decl(gen, key, (size_t)(end - key));
+	if (decl == NULL)
+		return -1;
+
+	decl->hash = gcfg_hash_bytes(GCFG_HASH_SEED, data + offset, size);
+	decl->offset = offset;
+	decl->size = size;
+	decl->line = line;
+	decl->state = DECL_ADDED;
+	return 0;
+}
+
+static int split_input(generation_t *gen, const gcfg_keyword_t *keywords,
+		       const char *data, size_t size)
+{
+	unsigned long lines = 0, first;
+	size_t offset = 0, len;
+
+	while (offset < size) {
+		first = lines;
+		len = gcfg_scan_declaration(data + offset, size - offset,
+					    keywords, &lines);
+
+		if (add_decl(gen, data, offset, len, first))
+			return -1;
+
+		offset += len;
+	}
+
+	return 0;
+}
+
+/*
+  Pairs the declarations of the new generation with those of the old one
+  that have the same first line, in the order they appear in. Paired ones
+  are changed if their hash differs, the others are added or removed.
+*/
+static int match_decls(generation_t *old, generation_t *gen)
+{
+	size_t i, mask, pos, size, *slots, *next;
+	const char *key;
+	uint32_t hash;
+
+	for (size = 16; size < 2 * old->count; size *= 2)
+		;
+
+	slots = calloc(size, sizeof(slots[0]));
+	if (slots == NULL)
+		return -1;
+
+	mask = size - 1;
+
+	for (i = 0; i < old->count; ++i) {
+		old->decls[i].matched = false;
+		old->decls[i].reported = false;
+		old->decls[i].dup = 0;
+	}
+
+	for (i = 0; i < old->count; ++i) {
+		key = old->keys + old->decls[i].key;
+		hash = (uint32_t)gcfg_hash_bytes(GCFG_HASH_SEED, key,
+						 strlen(key));
+		pos = hash & mask;
+
+		while (slots[pos] != 0 &&
+		       strcmp(old->keys + old->decls[slots[pos] - 1].key,
+			      key) != 0) {
+			pos = (pos + 1) & mask;
+		}
+
+		/* duplicates are chained in the order of the input */
+		next = slots + pos;
+		while (*next != 0)
+			next = &old->decls[*next - 1].dup;
+
+		*next = i + 1;
+	}
+
+	for (i = 0; i < gen->count; ++i) {
+		key = gen->keys + gen->decls[i].key;
+		hash = (uint32_t)gcfg_hash_bytes(GCFG_HASH_SEED, key,
+						 strlen(key));
+		pos = hash & mask;
+
+		while (slots[pos] != 0 &&
+		       strcmp(old->keys + old->decls[slots[pos] - 1].key,
+			      key) != 0) {
+			pos = (pos + 1) & mask;
+		}
+
+		/* the first duplicate that is not paired yet */
+		next = slots + pos;
+		while (*next != 0 && old->decls[*next - 1].matched)
+			next = &old->decls[*next - 1].dup;
+
+		if (*next == 0)
+			continue;
+
+		old->decls[*next - 1].matched = true;
+		gen->decls[i].match = *next;
+
+		if (!old->decls[*next - 1].dirty &&
+		    old->decls[*next - 1].hash == gen->decls[i].hash) {
+			gen->decls[i].state = DECL_UNCHANGED;
+		} else {
+			gen->decls[i].state = DECL_CHANGED;
+		}
+	}
+
+	free(slots);
+	return 0;
+}
+
+static int parse_decl(gcfg_tracker_t *tracker, const char *path,
+		      const char *data, const decl_t *decl, void *usr)
+{
+	gcfg_file_t *file;
+	int ret;
+
+	file = gcfg_file_open_memory(path, data + decl->offset, decl->size);
+	if (file == NULL)
+		return -1;
+
+	((gcfg_stdio_file_t *)file)->linenum = decl->line;
+
+	ret = gcfg_parse_file_from(file, tracker->keywords, usr, decl->line);
+	gcfg_file_close(file);
+	return ret;
+}
+
+static int deliver(gcfg_tracker_t *tracker, generation_t *gen,
+		   const char *path, const char *data, void *usr)
+{
+	generation_t *old = &tracker->gen;
+	const decl_t *decl;
+	size_t i;
+
+	for (i = 0; i < old->count; ++i) {
+		decl = old->decls + i;
+
+		if (decl->matched)
+			continue;
+
+		if (tracker->change(usr, GCFG_CHANGE_REMOVED,
+				    old->keys + decl->key)) {
+			return -1;
+		}
+
+		old->decls[i].reported = true;
+	}
+
+	for (i = 0; i < gen->count; ++i) {
+		decl = gen->decls + i;
+
+		if (decl->state == DECL_UNCHANGED)
+			continue;
+
+		gen->decls[i].reported = true;
+
+		if (tracker->change(usr, decl->state == DECL_ADDED ?
+				    GCFG_CHANGE_ADDED : GCFG_CHANGE_CHANGED,
+				    gen->keys + decl->key)) {
+			return -1;
+		}
+
+		if (parse_decl(tracker, path, data, decl, usr))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+  After a failed delivery, turns the new generation into what the callbacks
+  have seen: declarations they were called for are kept, but dirty, and
+  the others are kept in their previous version, if there was one.
+  Removed declarations that were not reported yet are carried over.
+*/
+static int keep_seen(generation_t *old, generation_t *gen)
+{
+	const decl_t *prev;
+	size_t i, j;
+	decl_t *decl;
+
+	for (i = 0, j = 0; i < gen->count; ++i) {
+		decl = gen->decls + i;
+
+		if (decl->reported) {
+			decl->dirty = true;
+		} else if (decl->state == DECL_CHANGED) {
+			prev = old->decls + decl->match - 1;
+			decl->hash = prev->hash;
+			decl->dirty = prev->dirty;
+		} else if (decl->state == DECL_ADDED) {
+			continue;
+		}
+
+		gen->decls[j++] = *decl;
+	}
+
+	gen->count = j;
+
+	for (i = 0; i < old->count; ++i) {
+		prev = old->decls + i;
+
+		if (prev->matched || prev->reported)
+			continue;
+
+		decl = push_decl(gen, old->keys + prev->key,
+				 strlen(old->keys + prev->key));
+		if (decl == NULL)
+			return -1;
+
+		decl->hash = prev->hash;
+		decl->dirty = prev->dirty;
+	}
+
+	return 0;
+}
+
+gcfg_tracker_t *gcfg_tracker_create(const gcfg_keyword_t *keywords,
+				    int (*change)(void *usr, int type,
+						  const char *line))
+{
+	gcfg_tracker_t *tracker = calloc(1, sizeof(*tracker));
+
+	if (tracker == NULL)
+		return NULL;
+
+	tracker->keywords = keywords;
+	tracker->change = change;
+	return tracker;
+}
+
+void gcfg_tracker_destroy(gcfg_tracker_t *tracker)
+{
+	generation_cleanup(&tracker->gen);
+	free(tracker);
+}
+
+int gcfg_tracker_update(gcfg_tracker_t *tracker, const char *path, void *usr)
+{
+	generation_t gen;
+	size_t i, size;
+	char *data;
+	int fd, ret;
+
+	memset(&gen, 0, sizeof(gen));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		goto fail_errno;
+
+	data = gcfg_read_fd(fd, &size);
+	close(fd);
+
+	if (data == NULL)
+		goto fail_errno;
+
+	if (split_input(&gen, tracker->keywords, data, size) ||
+	    match_decls(&tracker->gen, &gen)) {
+		/* no callback was called, the old generation still holds */
+		dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+		generation_cleanup(&gen);
+		ret = -1;
+		goto out;
+	}
+
+	ret = deliver(tracker, &gen, path, data, usr);
+
+	if (ret != 0 && keep_seen(&tracker->gen, &gen)) {
+		/* everything is delivered again, or reported as removed */
+		generation_cleanup(&gen);
+
+		for (i = 0; i < tracker->gen.count; ++i)
+			tracker->gen.decls[i].dirty = true;
+		goto out;
+	}
+
+	generation_cleanup(&tracker->gen);
+	tracker->gen = gen;
+out:
+	free(data);
+	return ret;
+fail_errno:
+	dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+	return -1;
+}
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * validate.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+/*
+  Words of stack memory for keyword indices, enough for a few dozen
+  typical lists. Lists beyond that are searched linearly.
+*/
+#define INDEX_ARENA (2048)
+
+int gcfg_validate_file(gcfg_file_t *file, const gcfg_keyword_t *keywords)
+{
+	gcfg_block_t stack[GCFG_DEFAULT_MAX_DEPTH];
+	uintptr_t arena[INDEX_ARENA];
+	gcfg_parse_ctx_t ctx;
+	gcfg_event_t ev;
+	int ret;
+
+	gcfg_parse_ctx_init_arena(&ctx, keywords, NULL, stack,
+				  GCFG_DEFAULT_MAX_DEPTH, arena, INDEX_ARENA);
+
+	do {
+		ret = gcfg_next_event(file, &ctx, &ev);
+		if (ret != 0)
+			return ret < 0 ? -1 : 0;
+
+		ret = gcfg_track_event(file, &ctx, &ev);
+	} while (ret == 0);
+
+	return -1;
+}
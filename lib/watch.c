@@ -0,0 +1,380 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * watch.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+
+#include <sys/inotify.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+
+/*
+  Directories are watched instead of the files themselves, so files that
+  are replaced through a rename, the way most editors and deploy tools
+  save them, are still noticed. A half written file is not noticed before
+  it is closed.
+*/
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+typedef struct {
+	char *path;
+	int wd;
+} watch_dir_t;
+
+typedef struct {
+	/* index of the directory the file is in */
+	size_t dir;
+
+	/* the file name, or a wildcard pattern for it */
+	char *name;
+	bool pattern;
+} watch_file_t;
+
+typedef struct {
+	watch_dir_t *dirs;
+	size_t dir_count;
+	size_t dir_max;
+
+	watch_file_t *files;
+	size_t file_count;
+	size_t file_max;
+} watch_list_t;
+
+struct gcfg_watch_t {
+	int fd;
+	char *path;
+	unsigned int debounce;
+
+	int (*reload)(void *usr, const char *path,
+		      gcfg_include_cache_t *cache);
+	void *usr;
+
+	gcfg_include_cache_t *cache;
+	watch_list_t list;
+};
+
+static void list_cleanup(watch_list_t *list)
+{
+	size_t i;
+
+	for (i = 0; i < list->dir_count; ++i)
+		free(list->dirs[i].path);
+
+	for (i = 0; i < list->file_count; ++i)
+		free(list->files[i].name);
+
+	free(list->dirs);
+	free(list->files);
+	memset(list, 0, sizeof(*list));
+}
+
+static int add_dir(gcfg_watch_t *w, watch_list_t *list, const char *path,
+		   size_t len, size_t *out)
+{
+	watch_dir_t *new;
+	size_t i, max;
+	char *copy;
+	int wd;
+
+	for (i = 0; i < list->dir_count; ++i) {
+		if (strlen(list->dirs[i].path) == len &&
+		    strncmp(list->dirs[i].path, path, len) == 0) {
+			*out = i;
+			return 0;
+		}
+	}
+
+	if (list->dir_count == list->dir_max) {
+		max = list->dir_max ? list->dir_max * 2 : 8;
+		new = realloc(list->dirs, max * sizeof(new[0]));
+		if (new == NULL)
+			return -1;
+
+		list->dirs = new;
+		list->dir_max = max;
+	}
+
+	copy = strndup(path, len);
+	if (copy == NULL)
+		return -1;
+
+	/* watching the same directory again returns the same descriptor */
+	wd = inotify_add_watch(w->fd, copy, WATCH_MASK);
+	if (wd < 0) {
+		free(copy);
+		return -1;
+	}
+
+	list->dirs[list->dir_count].path = copy;
+	list->dirs[list->dir_count].wd = wd;
+	*out = list->dir_count++;
+	return 0;
+}
+
+static bool has_wildcard(const char *path, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		if (path[i] == '*' || path[i] == '?' || path[i] == '[')
+			return true;
+	}
+
+	return false;
+}
+
+static int add_file(gcfg_watch_t *w, watch_list_t *list, const char *path,
+		    bool pattern)
+{
+	const char *slash = strrchr(path, '/'), *name = path;
+	watch_file_t *new;
+	size_t dir, max;
+	int ret;
+
+	if (slash == NULL) {
+		ret = add_dir(w, list, ".", 1, &dir);
+	} else {
+		/* directories matched by wildcards are not followed */
+		if (pattern && has_wildcard(path, (size_t)(slash - path)))
+			return 0;
+
+		name = slash + 1;
+		ret = add_dir(w, list, path,
+			      slash == path ? 1 : (size_t)(slash - path), &dir);
+	}
+
+	/* nothing to watch until the directory is created */
+	if (ret != 0)
+		return errno == ENOENT ? 0 : -1;
+
+	if (list->file_count == list->file_max) {
+		max = list->file_max ? list->file_max * 2 : 16;
+		new = realloc(list->files, max * sizeof(new[0]));
+		if (new == NULL)
+			return -1;
+
+		list->files = new;
+		list->file_max = max;
+	}
+
+	list->files[list->file_count].name = strdup(name);
+	if (list->files[list->file_count].name == NULL)
+		return -1;
+
+	list->files[list->file_count].dir = dir;
+	list->files[list->file_count].pattern = pattern;
+	list->file_count += 1;
+	return 0;
+}
+
+/* watches the files of the configuration as last parsed */
+static int update_watches(gcfg_watch_t *w)
+{
+	const char *path = w->path;
+	watch_list_t list;
+	size_t i, j;
+	bool pattern = false;
+
+	memset(&list, 0, sizeof(list));
+
+	/* the main file is watched even if it did not exist */
+	for (i = 0; path != NULL;
+	     path = gcfg_include_cache_path(w->cache, i++, &pattern)) {
+		if (add_file(w, &list, path, pattern))
+			goto fail;
+	}
+
+	for (i = 0; i < w->list.dir_count; ++i) {
+		for (j = 0; j < list.dir_count; ++j) {
+			if (list.dirs[j].wd == w->list.dirs[i].wd)
+				break;
+		}
+
+		if (j == list.dir_count)
+			inotify_rm_watch(w->fd, w->list.dirs[i].wd);
+	}
+
+	list_cleanup(&w->list);
+	w->list = list;
+	return 0;
+fail:
+	dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+	list_cleanup(&list);
+	return -1;
+}
+
+static bool is_relevant(const gcfg_watch_t *w, const struct inotify_event *ev,
+			const char *name)
+{
+	const watch_file_t *file;
+	size_t i;
+
+	if (ev->mask & IN_Q_OVERFLOW)
+		return true;
+
+	if (ev->len == 0)
+		return false;
+
+	for (i = 0; i < w->list.file_count; ++i) {
+		file = w->list.files + i;
+
+		if (w->list.dirs[file->dir].wd != ev->wd)
+			continue;
+
+		if (file->pattern) {
+			if (fnmatch(file->name, name, FNM_PERIOD) == 0)
+				return true;
+		} else if (strcmp(file->name, name) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+  Waits up to timeout milliseconds for events and reads all that are
+  pending. Sets *changed if one concerns the configuration. Returns 0 on
+  timeout, 1 if events were read, -1 on failure.
+*/
+static int read_events(gcfg_watch_t *w, int timeout, bool *changed)
+{
+	char buffer[4096 + sizeof(struct inotify_event) + NAME_MAX + 1];
+	struct inotify_event ev;
+	struct pollfd pfd;
+	ssize_t ret;
+	size_t i;
+
+	pfd.fd = w->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	ret = poll(&pfd, 1, timeout);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -1;
+	if (ret == 0)
+		return 0;
+
+	for (;;) {
+		ret = read(w->fd, buffer, sizeof(buffer));
+		if (ret < 0) {
+			if (errno == EAGAIN)
+				break;
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		/* the name is null-terminated and padded within len */
+		for (i = 0; i < (size_t)ret; i += sizeof(ev) + ev.len) {
+			memcpy(&ev, buffer + i, sizeof(ev));
+
+			if (is_relevant(w, &ev, buffer + i + sizeof(ev)))
+				*changed = true;
+		}
+	}
+
+	return 1;
+}
+
+static int reload(gcfg_watch_t *w)
+{
+	int ret = w->reload(w->usr, w->path, w->cache);
+
+	/* a broken configuration may still be fixed, keep watching it */
+	if (update_watches(w))
+		return -1;
+
+	return ret == 0 ? 1 : -1;
+}
+
+gcfg_watch_t *gcfg_watch_create(const char *path, unsigned int debounce,
+				int (*reload_cb)(void *usr, const char *path,
+						 gcfg_include_cache_t *cache),
+				void *usr)
+{
+	gcfg_watch_t *w = calloc(1, sizeof(*w));
+
+	if (w == NULL)
+		goto fail_errno;
+
+	w->fd = -1;
+	w->debounce = debounce > INT_MAX ? INT_MAX : debounce;
+	w->reload = reload_cb;
+	w->usr = usr;
+
+	w->path = strdup(path);
+	if (w->path == NULL)
+		goto fail_errno;
+
+	w->cache = gcfg_include_cache_create();
+	if (w->cache == NULL)
+		goto fail_errno;
+
+	w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->fd < 0)
+		goto fail_errno;
+
+	if (reload(w) < 0)
+		goto fail;
+
+	return w;
+fail_errno:
+	dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+fail:
+	if (w != NULL)
+		gcfg_watch_destroy(w);
+	return NULL;
+}
+
+int gcfg_watch_fd(const gcfg_watch_t *w)
+{
+	return w->fd;
+}
+
+int gcfg_watch_dispatch(gcfg_watch_t *w, int timeout)
+{
+	bool changed = false;
+	int ret;
+
+	ret = read_events(w, timeout, &changed);
+	if (ret <= 0 || !changed)
+		goto out;
+
+	/* coalesce a burst of writes, until it stays quiet for a while */
+	do {
+		changed = false;
+		ret = read_events(w, (int)w->debounce, &changed);
+		if (ret < 0)
+			goto out;
+	} while (changed);
+
+	return reload(w);
+out:
+	if (ret < 0) {
+		dprintf(STDERR_FILENO, "%s: %s\n", w->path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+void gcfg_watch_destroy(gcfg_watch_t *w)
+{
+	if (w->fd >= 0)
+		close(w->fd);
+
+	if (w->cache != NULL)
+		gcfg_include_cache_destroy(w->cache);
+
+	list_cleanup(&w->list);
+	free(w->path);
+	free(w);
+}
@@ -0,0 +1,246 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * doc_cache.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "gcfg.h"
+#include "test.h"
+
+#include <sys/stat.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+static char dir[] = "/tmp/gcfg_doc_cache_XXXXXX";
+static char source[128];
+static char cache[128];
+
+static void *cb_fail(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)parent; (void)val;
+	return NULL;
+}
+
+GCFG_BEGIN_KEYWORDS(item_keywords)
+	GCFG_KEYWORD_STRING("name", NULL, cb_fail, NULL),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(keywords)
+	GCFG_KEYWORD_STRING("item", item_keywords, cb_fail, NULL),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(other_keywords)
+	GCFG_KEYWORD_STRING("item", NULL, cb_fail, NULL),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_ENUM(mode_a)
+	GCFG_ENUM("fast", 1),
+	GCFG_ENUM("slow", 2),
+GCFG_END_ENUM();
+
+GCFG_BEGIN_ENUM(mode_b)
+	GCFG_ENUM("fast", 2),
+	GCFG_ENUM("slow", 1),
+GCFG_END_ENUM();
+
+GCFG_BEGIN_KEYWORDS(enum_a_keywords)
+	GCFG_KEYWORD_STRING("item", item_keywords, cb_fail, NULL),
+	GCFG_KEYWORD_ENUM("mode", NULL, mode_a, cb_fail, NULL),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(enum_b_keywords)
+	GCFG_KEYWORD_STRING("item", item_keywords, cb_fail, NULL),
+	GCFG_KEYWORD_ENUM("mode", NULL, mode_b, cb_fail, NULL),
+GCFG_END_KEYWORDS();
+
+static void write_source(const char *data)
+{
+	FILE *fp = fopen(source, "w");
+
+	if (fp == NULL || fputs(data, fp) == EOF) {
+		perror(source);
+		exit(EXIT_FAILURE);
+	}
+
+	fclose(fp);
+}
+
+static int check_document(const gcfg_document_t *doc, const char *name)
+{
+	const gcfg_node_t *node;
+	gcfg_value_t val;
+
+	node = gcfg_document_node(doc, 0);
+	node = gcfg_document_node(doc, node->child);
+	if (node == NULL)
+		return -1;
+
+	node = gcfg_document_node(doc, node->child);
+	if (node == NULL)
+		return -1;
+
+	gcfg_node_get_value(doc, node, &val);
+	return strcmp(val.data.string, name);
+}
+
+/* makes the first declaration its own child in the cache file */
+static int damage_cache(const gcfg_document_t *doc)
+{
+	const gcfg_node_t *node = gcfg_document_node(doc, 1);
+	uintptr_t base, page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uint32_t self = 1;
+	ssize_t ret;
+	int fd;
+
+	/* the cache is mapped as a whole, with the header on its first page */
+	base = (uintptr_t)node & ~(page - 1);
+
+	fd = open(cache, O_WRONLY);
+	if (fd < 0)
+		return -1;
+
+	ret = pwrite(fd, &self, sizeof(self),
+		     (off_t)((uintptr_t)&node->child - base));
+	close(fd);
+	return ret == (ssize_t)sizeof(self) ? 0 : -1;
+}
+
+static int check_schema(void)
+{
+	gcfg_document_t *doc;
+
+	doc = gcfg_document_load(keywords, source, cache);
+	if (doc == NULL) {
+		fputs("loading the cache failed\n", stderr);
+		return -1;
+	}
+
+	if (gcfg_document_save(doc, enum_a_keywords, source, cache)) {
+		gcfg_document_free(doc);
+		return -1;
+	}
+	gcfg_document_free(doc);
+
+	/* same names and types, but the tokens resolve to other values */
+	if (gcfg_document_load(enum_b_keywords, source, cache) != NULL) {
+		fputs("cache used with a remapped enum\n", stderr);
+		return -1;
+	}
+
+	doc = gcfg_document_load(enum_a_keywords, source, cache);
+	if (doc == NULL) {
+		fputs("loading the cache failed\n", stderr);
+		return -1;
+	}
+
+	if (damage_cache(doc)) {
+		gcfg_document_free(doc);
+		perror(cache);
+		return -1;
+	}
+	gcfg_document_free(doc);
+
+	if (gcfg_document_load(enum_a_keywords, source, cache) != NULL) {
+		fputs("damaged cache was used\n", stderr);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int run(void)
+{
+	struct timespec times[2];
+	gcfg_document_t *doc;
+	struct stat sb;
+
+	write_source("item \"a\" {\n\tname \"foo\"\n}\n");
+
+	/* no cache yet, parses the source and writes the cache */
+	doc = gcfg_parse_document_cached(source, keywords, cache);
+	if (doc == NULL || check_document(doc, "foo") != 0) {
+		fputs("parsing without cache failed\n", stderr);
+		return -1;
+	}
+	gcfg_document_free(doc);
+
+	if (stat(cache, &sb) != 0) {
+		fputs("cache file was not written\n", stderr);
+		return -1;
+	}
+
+	/* loads the same document from the cache */
+	doc = gcfg_document_load(keywords, source, cache);
+	if (doc == NULL || check_document(doc, "foo") != 0) {
+		fputs("loading the cache failed\n", stderr);
+		return -1;
+	}
+	gcfg_document_free(doc);
+
+	if (gcfg_document_load(other_keywords, source, cache) != NULL) {
+		fputs("cache used with different keywords\n", stderr);
+		return -1;
+	}
+
+	if (check_schema())
+		return -1;
+
+	/* same size and time stamp, but different content */
+	if (stat(source, &sb) != 0) {
+		perror(source);
+		return -1;
+	}
+
+	write_source("item \"a\" {\n\tname \"bar\"\n}\n");
+
+	times[0] = sb.st_atim;
+	times[1] = sb.st_mtim;
+
+	if (utimensat(AT_FDCWD, source, times, 0) != 0) {
+		perror(source);
+		return -1;
+	}
+
+	if (gcfg_document_load(keywords, source, cache) != NULL) {
+		fputs("cache used after the content changed\n", stderr);
+		return -1;
+	}
+
+	doc = gcfg_parse_document_cached(source, keywords, cache);
+	if (doc == NULL || check_document(doc, "bar") != 0) {
+		fputs("reparsing a changed source failed\n", stderr);
+		return -1;
+	}
+	gcfg_document_free(doc);
+
+	/* different size */
+	write_source("item \"a\" {\n\tname \"foobar\"\n}\n");
+
+	if (gcfg_document_load(keywords, source, cache) != NULL) {
+		fputs("cache used after the size changed\n", stderr);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	int ret;
+
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return EXIT_FAILURE;
+	}
+
+	snprintf(source, sizeof(source), "%s/test.cfg", dir);
+	snprintf(cache, sizeof(cache), "%s/test.cfg.cache", dir);
+
+	ret = run();
+
+	unlink(cache);
+	unlink(source);
+	rmdir(dir);
+	return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
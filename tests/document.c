@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * document.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "test.h"
+
+static void *cb_fail(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)parent; (void)val;
+	fputs("document parser called a keyword callback\n", stderr);
+	exit(EXIT_FAILURE);
+}
+
+/* only decides if a keyword has a listing, the document ends it at '}' */
+static int cb_listing(gcfg_file_t *f, void *child, const char *line)
+{
+	(void)f; (void)child; (void)line;
+	return 0;
+}
+
+GCFG_BEGIN_KEYWORDS(item_keywords)
+	GCFG_KEYWORD_NUMBER("size", NULL, cb_fail, NULL),
+	GCFG_KEYWORD_STRING("name", NULL, cb_fail, NULL),
+GCFG_END_KEYWORDS();
+
+static const gcfg_keyword_t keywords[] = {
+	GCFG_KEYWORD_STRING("item", item_keywords, cb_fail, NULL),
+	{
+		.name = "files",
+		.arg = GCFG_VALUE_NONE,
+		.set_property = cb_fail,
+		.handle_listing = cb_listing,
+	},
+	GCFG_KEYWORD_BOOL("enable", NULL, cb_fail, NULL),
+	{ .name = NULL },
+};
+
+static const char *config[] = {
+	"item \"first\" {",
+	"	size 42",
+	"	name \"foo\"",
+	"}",
+	"item \"second\" {",
+	"}",
+	"files {",
+	"	/bin/sh",
+	"}",
+	"enable yes",
+	NULL,
+};
+
+static const char *broken[] = {
+	"item \"first\" {",
+	"	size 42",
+	NULL,
+};
+
+static gcfg_document_t *parse(const char **lines, const gcfg_keyword_t *kwd)
+{
+	line_file_t file;
+
+	line_file_init(&file, lines);
+
+	return gcfg_parse_document((gcfg_file_t *)&file, kwd);
+}
+
+static const gcfg_node_t *check_node(const gcfg_document_t *doc,
+				     uint32_t index, uint32_t type,
+				     uint32_t keyword, const char *name)
+{
+	const gcfg_node_t *node = gcfg_document_node(doc, index);
+	const char *str;
+
+	if (node == NULL) {
+		fprintf(stderr, "node %u missing\n", (unsigned int)index);
+		exit(EXIT_FAILURE);
+	}
+
+	str = gcfg_document_string(doc, node->name);
+
+	if (node->type != type || node->keyword != keyword ||
+	    str == NULL || strcmp(str, name) != 0) {
+		fprintf(stderr, "node %u: expected %s\n", (unsigned int)index,
+			name);
+		exit(EXIT_FAILURE);
+	}
+
+	return node;
+}
+
+int main(void)
+{
+	const gcfg_node_t *root, *item, *node;
+	gcfg_document_t *doc;
+	gcfg_value_t val;
+
+	doc = parse(config, keywords);
+	if (doc == NULL) {
+		fputs("parsing document failed\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	root = gcfg_document_node(doc, 0);
+	if (root == NULL || root->type != GCFG_NODE_ROOT) {
+		fputs("node 0 is not the root\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	/* first item, with two children */
+	item = check_node(doc, root->child, GCFG_NODE_BLOCK, 0, "item");
+	gcfg_node_get_value(doc, item, &val);
+
+	if (val.type != GCFG_VALUE_STRING ||
+	    strcmp(val.data.string, "first") != 0) {
+		fputs("wrong value for first item\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	node = check_node(doc, item->child, GCFG_NODE_KEYWORD, 0, "size");
+	if (node->value.type != GCFG_VALUE_NUMBER ||
+	    node->value.data.number[0].value != 42) {
+		fputs("wrong value for size\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	node = check_node(doc, node->next, GCFG_NODE_KEYWORD, 1, "name");
+	gcfg_node_get_value(doc, node, &val);
+
+	if (node->next != 0 || strcmp(val.data.string, "foo") != 0) {
+		fputs("wrong value for name\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	/* empty second item */
+	item = check_node(doc, item->next, GCFG_NODE_BLOCK, 0, "item");
+	if (item->child != 0) {
+		fputs("empty block has children\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	/* listing */
+	item = check_node(doc, item->next, GCFG_NODE_BLOCK, 1, "files");
+	node = check_node(doc, item->child, GCFG_NODE_LISTING_LINE, 0,
+			  "\t/bin/sh");
+	if (node->next != 0) {
+		fputs("'}' stored as listing line\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	item = check_node(doc, item->next, GCFG_NODE_KEYWORD, 2, "enable");
+	if (item->next != 0 || !item->value.data.boolean) {
+		fputs("wrong value for enable\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (gcfg_document_node_count(doc) != 8 ||
+	    gcfg_document_node(doc, 8) != NULL) {
+		fputs("unexpected number of nodes\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	gcfg_document_free(doc);
+
+	if (parse(broken, keywords) != NULL) {
+		fputs("unterminated block accepted\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -26,3 +26,24 @@ void dummy_file_cleanup(gcfg_file_t *f)
 {
 	free(f->buffer);
 }
+
+static int line_fetch_line(gcfg_file_t *f)
+{
+	line_file_t *file = (line_file_t *)f;
+
+	if (file->lines[file->index] == NULL)
+		return 1;
+
+	assert(strlen(file->lines[file->index]) < sizeof(file->buffer));
+	strcpy(file->buffer, file->lines[file->index++]);
+	return 0;
+}
+
+void line_file_init(line_file_t *file, const char **lines)
+{
+	memset(file, 0, sizeof(*file));
+	file->base.report_error = dummy_report_error;
+	file->base.fetch_line = line_fetch_line;
+	file->base.buffer = file->buffer;
+	file->lines = lines;
+}
@@ -0,0 +1,533 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * file.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "gcfg.h"
+#include "test.h"
+
+#include <unistd.h>
+
+#ifdef GCFG_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+static const struct {
+	const char *in;
+	size_t count;
+	const char *lines[4];
+} testvec[] = {
+	{ "", 0, { NULL } },
+	{ "\n", 1, { "" } },
+	{ "foo", 1, { "foo" } },
+	{ "foo\nbar\n", 2, { "foo", "bar" } },
+	{ "foo\r\n\r\nbar", 3, { "foo", "", "bar" } },
+	{ "\n\nfoo\n", 3, { "", "", "foo" } },
+};
+
+static void write_file(const char *path, const char *data, size_t size)
+{
+	FILE *fp = fopen(path, "wb");
+
+	if (fp == NULL || fwrite(data, 1, size, fp) != size) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	fclose(fp);
+}
+
+static char *memory;
+
+static size_t read_file(const char *path)
+{
+	FILE *fp = fopen(path, "rb");
+	long size;
+
+	if (fp == NULL || fseek(fp, 0, SEEK_END) != 0 ||
+	    (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	free(memory);
+	memory = malloc((size_t)size + 1);
+
+	if (memory == NULL ||
+	    fread(memory, 1, (size_t)size, fp) != (size_t)size) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	fclose(fp);
+	return (size_t)size;
+}
+
+static gcfg_file_t *open_memory(const char *path)
+{
+	size_t size = read_file(path);
+
+	return gcfg_file_open_memory(path, memory, size);
+}
+
+#ifdef GCFG_WITH_ZLIB
+static char gzpath[64];
+
+static gcfg_file_t *open_gzip(const char *path)
+{
+	size_t size = read_file(path);
+	gzFile gz;
+
+	/* write two gzip members, the reader must concatenate them */
+	snprintf(gzpath, sizeof(gzpath), "%s.gz", path);
+
+	gz = gzopen(gzpath, "wb");
+	if (gz == NULL || gzwrite(gz, memory, (unsigned)(size / 2)) < 0 ||
+	    gzclose(gz) != Z_OK) {
+		fprintf(stderr, "%s: error writing gzip file\n", gzpath);
+		exit(EXIT_FAILURE);
+	}
+
+	gz = gzopen(gzpath, "ab");
+	if (gz == NULL || gzwrite(gz, memory + size / 2,
+				  (unsigned)(size - size / 2)) < 0 ||
+	    gzclose(gz) != Z_OK) {
+		fprintf(stderr, "%s: error writing gzip file\n", gzpath);
+		exit(EXIT_FAILURE);
+	}
+
+	return gcfg_file_open_compressed(gzpath);
+}
+#endif
+
+static gcfg_file_t *(*open_fun[])(const char *) = {
+	gcfg_file_open,
+	gcfg_file_open_mmap,
+	gcfg_file_open_async,
+	gcfg_file_open_compressed,
+	open_memory,
+#ifdef GCFG_WITH_ZLIB
+	open_gzip,
+#endif
+};
+
+#ifndef GCFG_DISABLE_ALLOC
+static gcfg_file_t *(*seek_fun[])(const char *) = {
+	gcfg_file_open,
+	gcfg_file_open_mmap,
+	open_memory,
+};
+#endif
+
+static gcfg_file_t *(*open_file)(const char *path);
+
+static void test_case(const char *path, size_t i)
+{
+	gcfg_file_t *file;
+	size_t count = 0;
+	int ret;
+
+	write_file(path, testvec[i].in, strlen(testvec[i].in));
+
+	file = open_file(path);
+	if (file == NULL)
+		exit(EXIT_FAILURE);
+
+	while ((ret = file->fetch_line(file)) == 0) {
+		if (count >= testvec[i].count) {
+			fprintf(stderr, "Too many lines for %zu\n", i);
+			exit(EXIT_FAILURE);
+		}
+
+		if (strcmp(file->buffer, testvec[i].lines[count]) != 0) {
+			fprintf(stderr, "Mismatch for %zu, line %zu\n",
+				i, count);
+			fprintf(stderr, "Expected: %s\n",
+				testvec[i].lines[count]);
+			fprintf(stderr, "Received: %s\n", file->buffer);
+			exit(EXIT_FAILURE);
+		}
+
+		++count;
+	}
+
+	if (ret < 0 || count != testvec[i].count) {
+		fprintf(stderr, "Wrong line count for %zu\n", i);
+		exit(EXIT_FAILURE);
+	}
+
+	gcfg_file_close(file);
+}
+
+static void test_case_batch(const char *path, size_t i)
+{
+	gcfg_file_t *file;
+	size_t j, count = 0;
+	int ret;
+
+	write_file(path, testvec[i].in, strlen(testvec[i].in));
+
+	file = open_file(path);
+	if (file == NULL)
+		exit(EXIT_FAILURE);
+
+	while ((ret = file->fetch_lines(file)) == 0) {
+		for (j = 0; j < file->line_count; ++j, ++count) {
+			if (count >= testvec[i].count) {
+				fprintf(stderr, "Too many lines for %zu\n", i);
+				exit(EXIT_FAILURE);
+			}
+
+			if (strcmp(file->lines[j].data,
+				   testvec[i].lines[count]) != 0 ||
+			    strlen(testvec[i].lines[count]) !=
+			    file->lines[j].length) {
+				fprintf(stderr, "Batch mismatch for %zu, "
+					"line %zu\n", i, count);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	if (ret < 0 || count != testvec[i].count) {
+		fprintf(stderr, "Wrong batch line count for %zu\n", i);
+		exit(EXIT_FAILURE);
+	}
+
+	gcfg_file_close(file);
+}
+
+static void test_long_lines(const char *path)
+{
+	size_t i, size, count = 0;
+	gcfg_file_t *file;
+	char *data, *ptr;
+
+	/*
+	  Lines of increasing length (up to half the default buffer size of
+	  the read() based implementation, which must also work without
+	  malloc), spanning multiple chunks. The last one has no line break
+	  and the file ends exactly at a page boundary.
+	*/
+	size = 64 * (size_t)sysconf(_SC_PAGESIZE);
+
+	data = malloc(size);
+	if (data == NULL) {
+		perror("allocating test data");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(data, 'A', size);
+
+	for (i = 1, ptr = data; (size_t)(ptr - data) + i < size;) {
+		ptr[i] = '\n';
+		ptr += i + 1;
+
+		if (i < 32768)
+			i *= 2;
+	}
+
+	write_file(path, data, size);
+
+	file = open_file(path);
+	if (file == NULL)
+		exit(EXIT_FAILURE);
+
+	for (ptr = data; ptr < data + size; ptr += strlen(file->buffer) + 1) {
+		if (file->fetch_line(file) != 0) {
+			fprintf(stderr, "Error reading line %zu\n", count);
+			exit(EXIT_FAILURE);
+		}
+
+		if (strncmp(file->buffer, ptr, strlen(file->buffer)) != 0 ||
+		    (ptr[strlen(file->buffer)] != '\n' &&
+		     ptr + strlen(file->buffer) != data + size)) {
+			fprintf(stderr, "Mismatch for long line %zu\n",
+				count);
+			exit(EXIT_FAILURE);
+		}
+
+		++count;
+	}
+
+	if (file->fetch_line(file) <= 0) {
+		fprintf(stderr, "Expected EOF after long lines\n");
+		exit(EXIT_FAILURE);
+	}
+
+	gcfg_file_close(file);
+	free(data);
+}
+
+static void test_utf8_flag(const char *path)
+{
+	static const char charset[] = "abc {}#\"\t\t\r\n\n\n\x01\x7F\xC3\xA4";
+	size_t i, j, size = 16384;
+	gcfg_file_t *file;
+	bool plain;
+	char *data;
+	int c;
+
+	data = malloc(size);
+	if (data == NULL) {
+		perror("allocating test data");
+		exit(EXIT_FAILURE);
+	}
+
+	srand(42);
+	for (i = 0; i < size; ++i)
+		data[i] = charset[(size_t)rand() % (sizeof(charset) - 1)];
+
+	write_file(path, data, size);
+
+	file = open_file(path);
+	if (file == NULL)
+		exit(EXIT_FAILURE);
+
+	while (file->fetch_lines(file) == 0) {
+		for (i = 0; i < file->line_count; ++i) {
+			const gcfg_line_t *line = file->lines + i;
+
+			plain = true;
+			for (j = 0; j < line->length; ++j) {
+				c = (unsigned char)line->data[j];
+
+				if ((c < 0x20 && c != '\t') || c >= 0x7F)
+					plain = false;
+			}
+
+			if ((line->flags & GCFG_LINE_VALID_UTF8) != 0) {
+				if (!plain || !gcfg_is_valid_utf8(
+					    (const uint8_t *)line->data,
+					    line->length)) {
+					fputs("Line wrongly flagged as "
+					      "valid UTF-8\n", stderr);
+					exit(EXIT_FAILURE);
+				}
+			} else if (plain) {
+				fputs("Plain ASCII line not flagged as "
+				      "valid UTF-8\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	gcfg_file_close(file);
+	free(data);
+}
+
+#ifndef GCFG_DISABLE_ALLOC
+static void test_huge_lines(const char *path, bool newline)
+{
+	static const size_t length[] = { 200 * 1024, 3, 300 * 1024 };
+	size_t i, j, size = 0;
+	gcfg_file_t *file;
+	char *data, *ptr;
+
+	/*
+	  Lines several times the size of a chunk, which the buffer has to
+	  grow for. The last one optionally has no line break.
+	*/
+	for (i = 0; i < sizeof(length) / sizeof(length[0]); ++i)
+		size += length[i] + 1;
+
+	data = malloc(size);
+	if (data == NULL) {
+		perror("allocating test data");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0, ptr = data; i < sizeof(length) / sizeof(length[0]); ++i) {
+		for (j = 0; j < length[i]; ++j)
+			*(ptr++) = (char)('a' + (i + j) % 26);
+
+		*(ptr++) = '\n';
+	}
+
+	write_file(path, data, newline ? size : size - 1);
+
+	file = open_file(path);
+	if (file == NULL)
+		exit(EXIT_FAILURE);
+
+	for (i = 0, ptr = data; i < sizeof(length) / sizeof(length[0]); ++i) {
+		if (file->fetch_line(file) != 0) {
+			fprintf(stderr, "Error reading huge line %zu\n", i);
+			exit(EXIT_FAILURE);
+		}
+
+		if (strlen(file->buffer) != length[i] ||
+		    memcmp(file->buffer, ptr, length[i]) != 0) {
+			fprintf(stderr, "Mismatch for huge line %zu\n", i);
+			exit(EXIT_FAILURE);
+		}
+
+		ptr += length[i] + 1;
+	}
+
+	if (file->fetch_line(file) <= 0) {
+		fprintf(stderr, "Expected EOF after huge lines\n");
+		exit(EXIT_FAILURE);
+	}
+
+	gcfg_file_close(file);
+	free(data);
+}
+
+static void expect_line(gcfg_file_t *file, const char *data, size_t line)
+{
+	const char *ptr = data;
+	size_t i;
+
+	for (i = 1; i < line; ++i)
+		ptr = strchr(ptr, '\n') + 1;
+
+	if (file->fetch_line(file) != 0 ||
+	    strncmp(file->buffer, ptr, strlen(file->buffer)) != 0 ||
+	    ptr[strlen(file->buffer)] != '\n') {
+		fprintf(stderr, "Mismatch after seeking to line %zu\n", line);
+		exit(EXIT_FAILURE);
+	}
+
+	/* lines are allowed to be modified in place */
+	memset(file->buffer, 'x', strlen(file->buffer));
+}
+
+static void test_seek(const char *path)
+{
+	size_t i, size, count = 0;
+	gcfg_file_t *file;
+	char *data, *ptr;
+
+	/* lines of varying length, spanning several pages */
+	size = 16 * (size_t)sysconf(_SC_PAGESIZE);
+
+	data = malloc(size);
+	if (data == NULL) {
+		perror("allocating test data");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < size; ++i)
+		data[i] = (char)('a' + i % 26);
+
+	for (ptr = data; (size_t)(ptr - data) + 100 < size; ++count) {
+		ptr += 10 + (count * 37) % 90;
+		*(ptr++) = '\n';
+	}
+
+	data[size - 1] = '\n';
+	++count;
+
+	write_file(path, data, size);
+
+	file = open_file(path);
+	if (file == NULL || gcfg_file_build_index(file) != 0)
+		exit(EXIT_FAILURE);
+
+	for (i = 1; i <= count; ++i)
+		expect_line(file, data, i);
+
+	if (file->fetch_line(file) <= 0) {
+		fprintf(stderr, "Expected EOF before seeking\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = count; i > 0; i -= 7) {
+		if (gcfg_file_seek_line(file, i) != 0)
+			exit(EXIT_FAILURE);
+
+		expect_line(file, data, i);
+
+		if (i < count)
+			expect_line(file, data, i + 1);
+
+		if (i < 7)
+			break;
+	}
+
+	/* the offset of the third line plus a few bytes */
+	ptr = strchr(strchr(data, '\n') + 1, '\n') + 1;
+
+	if (gcfg_file_seek_offset(file, (uint64_t)(ptr - data) + 5) != 0)
+		exit(EXIT_FAILURE);
+
+	expect_line(file, data, 3);
+
+	if (gcfg_file_seek_line(file, count + 1) == 0 ||
+	    gcfg_file_seek_offset(file, size) == 0) {
+		fprintf(stderr, "Seeking past the end must fail\n");
+		exit(EXIT_FAILURE);
+	}
+
+	gcfg_file_close(file);
+	free(data);
+}
+#else
+static void test_compressed(const char *path)
+{
+	static const char gzip_data[] = "\x1F\x8B\x08\x00";
+	static const char zstd_data[] = "\x28\xB5\x2F\xFD";
+
+	write_file(path, gzip_data, sizeof(gzip_data) - 1);
+
+	if (gcfg_file_open_compressed(path) != NULL) {
+		fputs("gzip file opened without decompression\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	write_file(path, zstd_data, sizeof(zstd_data) - 1);
+
+	if (gcfg_file_open_compressed(path) != NULL) {
+		fputs("zstd file opened without decompression\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+}
+#endif
+
+int main(void)
+{
+	char path[] = "file_test.XXXXXX";
+	size_t i, j;
+	int fd;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	for (j = 0; j < sizeof(open_fun) / sizeof(open_fun[0]); ++j) {
+		open_file = open_fun[j];
+
+		for (i = 0; i < sizeof(testvec) / sizeof(testvec[0]); ++i) {
+			test_case(path, i);
+			test_case_batch(path, i);
+		}
+
+		test_long_lines(path);
+		test_utf8_flag(path);
+#ifndef GCFG_DISABLE_ALLOC
+		test_huge_lines(path, true);
+		test_huge_lines(path, false);
+#endif
+	}
+
+#ifndef GCFG_DISABLE_ALLOC
+	for (j = 0; j < sizeof(seek_fun) / sizeof(seek_fun[0]); ++j) {
+		open_file = seek_fun[j];
+		test_seek(path);
+	}
+#else
+	test_compressed(path);
+#endif
+
+	free(memory);
+	unlink(path);
+#ifdef GCFG_WITH_ZLIB
+	unlink(gzpath);
+#endif
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * file_async.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+#include "test.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+
+#define CHUNKS (6)
+#define LINE_SIZE (64)
+#define DELAY_MS (40)
+
+static bool slow = false;
+
+static void sleep_ms(long ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = ms * 1000000L;
+
+	while (nanosleep(&ts, &ts) != 0)
+		;
+}
+
+static long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long)ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/*
+  Replaces the read() used by the library, so every read of the input takes
+  as long as working on the lines of the chunk it returns.
+*/
+ssize_t read(int fd, void *buf, size_t count)
+{
+	if (slow)
+		sleep_ms(DELAY_MS);
+
+	return (ssize_t)syscall(SYS_read, fd, buf, count);
+}
+
+static long measure(const char *path, gcfg_file_t *(*open_file)(const char *))
+{
+	size_t count = 0;
+	gcfg_file_t *file;
+	char expect[16];
+	long start;
+	int ret;
+
+	start = now_ms();
+	slow = true;
+
+	file = open_file(path);
+	if (file == NULL)
+		exit(EXIT_FAILURE);
+
+	while ((ret = file->fetch_line(file)) == 0) {
+		snprintf(expect, sizeof(expect), "%lu", (unsigned long)count);
+
+		if (strncmp(file->buffer, expect, strlen(expect)) != 0 ||
+		    strlen(file->buffer) != LINE_SIZE - 1) {
+			fprintf(stderr, "line %lu: unexpected content\n",
+				(unsigned long)count);
+			exit(EXIT_FAILURE);
+		}
+
+		/* pretend to work on the lines, as long per chunk as reading */
+		if (count++ % (CHUNK_SIZE / LINE_SIZE / 8) == 0)
+			sleep_ms(DELAY_MS / 8);
+	}
+
+	gcfg_file_close(file);
+	slow = false;
+
+	if (ret < 0 || count * LINE_SIZE != CHUNKS * CHUNK_SIZE) {
+		fputs("reading the file failed\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	return now_ms() - start;
+}
+
+int main(void)
+{
+	char path[] = "file_async_test.XXXXXX";
+	long sync_ms, async_ms;
+	char line[LINE_SIZE];
+	size_t i;
+	FILE *fp;
+	int fd;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		perror(path);
+		unlink(path);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < CHUNKS * CHUNK_SIZE / LINE_SIZE; ++i) {
+		memset(line, 'x', sizeof(line));
+		snprintf(line, sizeof(line), "%lu", (unsigned long)i);
+		line[strlen(line)] = 'x';
+		line[LINE_SIZE - 1] = '\n';
+		fwrite(line, 1, sizeof(line), fp);
+	}
+
+	if (fclose(fp) != 0) {
+		perror(path);
+		unlink(path);
+		return EXIT_FAILURE;
+	}
+
+	sync_ms = measure(path, gcfg_file_open);
+	async_ms = measure(path, gcfg_file_open_async);
+	unlink(path);
+
+	/* reading ahead while the lines are processed should save about
+	   half the time, anything less means the two do not overlap */
+	if (async_ms * 4 > sync_ms * 3) {
+		fprintf(stderr, "background reading took %ld ms, "
+			"reading in place %ld ms\n", async_ms, sync_ms);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
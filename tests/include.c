@@ -0,0 +1,215 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * include.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "gcfg.h"
+#include "test.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+static char dir[] = "/tmp/gcfg_include_XXXXXX";
+static char result[256];
+
+static void *cb_value(gcfg_file_t *file, void *parent,
+		      const gcfg_value_t *value)
+{
+	(void)file;
+	strcat(result, value->data.string);
+	strcat(result, ",");
+	return parent;
+}
+
+GCFG_BEGIN_KEYWORDS(keywords)
+	GCFG_KEYWORD_STRING("value", NULL, cb_value, NULL),
+GCFG_END_KEYWORDS();
+
+static void write_file(const char *name, const char *data)
+{
+	char path[128];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fp = fopen(path, "w");
+
+	if (fp == NULL || fputs(data, fp) == EOF) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	fclose(fp);
+}
+
+static void remove_file(const char *name)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	unlink(path);
+}
+
+/* rewrites a file with data of the same size, keeping its time stamps */
+static void replace_file(const char *name, const char *data)
+{
+	struct timespec times[2];
+	char path[128];
+	struct stat sb;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	if (stat(path, &sb) != 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	write_file(name, data);
+
+	times[0] = sb.st_atim;
+	times[1] = sb.st_mtim;
+
+	if (utimensat(AT_FDCWD, path, times, 0) != 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void touch_file(const char *name)
+{
+	struct timespec times[2];
+	char path[128];
+	struct stat sb;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	if (stat(path, &sb) != 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	times[0] = sb.st_atim;
+	times[1] = sb.st_mtim;
+	times[1].tv_sec += 1;
+
+	if (utimensat(AT_FDCWD, path, times, 0) != 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static int parse(gcfg_include_cache_t *cache)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path), "%s/root.cfg", dir);
+	result[0] = '\0';
+	return gcfg_parse_path(path, keywords, result, cache);
+}
+
+int main(void)
+{
+	gcfg_include_cache_t *cache;
+	char path[128];
+
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return EXIT_FAILURE;
+	}
+
+	snprintf(path, sizeof(path), "%s/conf.d", dir);
+	if (mkdir(path, 0755) != 0) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	cache = gcfg_include_cache_create();
+	if (cache == NULL) {
+		perror("creating include cache");
+		return EXIT_FAILURE;
+	}
+
+	write_file("root.cfg", "value \"a\"\n"
+		   "include \"conf.d/*.cfg\"\n"
+		   "include \"last.cfg\"\n");
+	write_file("conf.d/1.cfg", "value \"b\"\n");
+	write_file("conf.d/2.cfg", "value \"c\"\n");
+	write_file("last.cfg", "value \"d\"\n");
+
+	if (parse(cache) != 0 || strcmp(result, "a,b,c,d,") != 0) {
+		fprintf(stderr, "first pass: got '%s'\n", result);
+		return EXIT_FAILURE;
+	}
+
+	/* same again from the cache, with a fragment removed */
+	remove_file("conf.d/1.cfg");
+
+	if (parse(cache) != 0 || strcmp(result, "a,c,d,") != 0) {
+		fprintf(stderr, "second pass: got '%s'\n", result);
+		return EXIT_FAILURE;
+	}
+
+	/* unchanged size and time stamp, the fragment is not read again */
+	replace_file("conf.d/2.cfg", "value \"x\"\n");
+
+	if (parse(cache) != 0 || strcmp(result, "a,c,d,") != 0) {
+		fprintf(stderr, "unchanged fragment: got '%s'\n", result);
+		return EXIT_FAILURE;
+	}
+
+	touch_file("conf.d/2.cfg");
+
+	if (parse(cache) != 0 || strcmp(result, "a,x,d,") != 0) {
+		fprintf(stderr, "changed fragment: got '%s'\n", result);
+		return EXIT_FAILURE;
+	}
+
+	/* the second include of the same file is replayed */
+	write_file("last.cfg", "value \"d\"\ninclude \"conf.d/2.cfg\"\n");
+
+	if (parse(cache) != 0 || strcmp(result, "a,x,d,x,") != 0) {
+		fprintf(stderr, "included twice: got '%s'\n", result);
+		return EXIT_FAILURE;
+	}
+
+	/* the last file includes the root file again */
+	write_file("last.cfg", "value \"e\"\ninclude \"root.cfg\"\n");
+
+	if (parse(cache) == 0) {
+		fputs("include cycle was not detected\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	/* a missing file is an error, an empty glob is not */
+	write_file("last.cfg", "include \"missing.cfg\"\n");
+
+	if (parse(cache) == 0) {
+		fputs("missing include file was not reported\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	write_file("last.cfg", "include \"missing/*.cfg\"\n");
+
+	if (parse(cache) != 0 || strcmp(result, "a,x,") != 0) {
+		fprintf(stderr, "empty glob: got '%s'\n", result);
+		return EXIT_FAILURE;
+	}
+
+	write_file("last.cfg", "");
+
+	if (parse(cache) != 0 || strcmp(result, "a,x,") != 0) {
+		fprintf(stderr, "empty file: got '%s'\n", result);
+		return EXIT_FAILURE;
+	}
+
+	gcfg_include_cache_destroy(cache);
+
+	remove_file("conf.d/2.cfg");
+	remove_file("last.cfg");
+	remove_file("root.cfg");
+	snprintf(path, sizeof(path), "%s/conf.d", dir);
+	rmdir(path);
+	rmdir(dir);
+	return EXIT_SUCCESS;
+}
@@ -21,11 +21,40 @@ static const char *must_not_work[] = {
 	"\xC0\xA0",
 	"\x7F",
 	"\xFF",
+	"\xED\xA0\x80",
+	"\xEF\xBF\xBE",
+	"\xEF\xB7\x90",
+	"\xF4\x90\x80\x80",
 };
 
+/*
+  Embedded at every offset of a longer ASCII string, so they end up at
+  every position within and across the blocks of a vectorized check.
+*/
+static const char *embed_work[] = {
+	"\t", "~", "\xC3\xA4", "\xE4\xB8\xAD", "\xF0\x9F\x98\x80",
+};
+
+static const char *embed_not_work[] = {
+	"\x01", "\x1F", "\x7F", "\x80", "\xC3", "\xE4\xB8", "\xC0\xA0",
+	"\xED\xA0\x80", "\xEF\xBF\xBF", "\xF4\x90\x80\x80",
+};
+
+static bool check_embedded(const char *seq, size_t offset)
+{
+	uint8_t buffer[96];
+	size_t len = strlen(seq);
+
+	memset(buffer, 'a', sizeof(buffer));
+	memcpy(buffer + offset, seq, len);
+
+	return gcfg_is_valid_utf8(buffer, offset + len) &&
+		gcfg_is_valid_utf8(buffer, sizeof(buffer));
+}
+
 int main(void)
 {
-	size_t i;
+	size_t i, j;
 
 	for (i = 0; i < sizeof(must_work) / sizeof(must_work[0]); ++i) {
 		if (!gcfg_is_valid_utf8((const uint8_t *)must_work[i],
@@ -44,5 +73,28 @@ int main(void)
 		}
 	}
 
+	for (i = 0; i < 90; ++i) {
+		for (j = 0; j < sizeof(embed_work) / sizeof(embed_work[0]);
+		     ++j) {
+			if (!check_embedded(embed_work[j], i)) {
+				fprintf(stderr, "embedded entry %lu was "
+					"rejected at offset %lu!\n",
+					(unsigned long)j, (unsigned long)i);
+				return EXIT_FAILURE;
+			}
+		}
+
+		for (j = 0;
+		     j < sizeof(embed_not_work) / sizeof(embed_not_work[0]);
+		     ++j) {
+			if (check_embedded(embed_not_work[j], i)) {
+				fprintf(stderr, "embedded entry %lu was "
+					"accepted at offset %lu!\n",
+					(unsigned long)j, (unsigned long)i);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * parse_batch.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "test.h"
+
+static char trace[512];
+static int top_level, switch_obj;
+
+static void record(const char *str)
+{
+	size_t len = strlen(trace);
+
+	snprintf(trace + len, sizeof(trace) - len, "%s", str);
+}
+
+static void report_error(gcfg_file_t *f, const char *msg, ...)
+{
+	(void)f; (void)msg;
+	record("error;");
+}
+
+static int cb_batch(gcfg_file_t *f, void *parent, const gcfg_value_t *values,
+		    size_t count)
+{
+	size_t i;
+
+	(void)f;
+	record(parent == &switch_obj ? "port[" : "after[");
+
+	for (i = 0; i < count; ++i) {
+		if (strcmp(values[i].data.string, "reject") == 0)
+			return -1;
+
+		record(i > 0 ? "," : "");
+		record(values[i].data.string);
+	}
+
+	record("];");
+	return 0;
+}
+
+static void *cb_switch(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)parent;
+	record(val->data.string);
+	record(";");
+	return &switch_obj;
+}
+
+static void *cb_mtu(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)val;
+	record("mtu;");
+	return parent;
+}
+
+static int cb_close(gcfg_file_t *f, void *child)
+{
+	(void)f; (void)child;
+	record("close;");
+	return 0;
+}
+
+GCFG_BEGIN_KEYWORDS(switch_keywords)
+	GCFG_KEYWORD_BATCH_BASE("port", GCFG_VALUE_STRING, NULL, cb_batch),
+	GCFG_KEYWORD_NUMBER("mtu", NULL, cb_mtu, NULL),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(keywords)
+	GCFG_KEYWORD_BATCH_BASE("after", GCFG_VALUE_STRING, NULL, cb_batch),
+	GCFG_KEYWORD_STRING("switch", switch_keywords, cb_switch, cb_close),
+GCFG_END_KEYWORDS();
+
+static const char *config[] = {
+	"after \"a\"",
+	"",
+	"after \"b\" # comment",
+	"switch \"s1\" {",
+	"	port \"p1\"",
+	"	port \"p2\"",
+	"	port \"p3\"",
+	"	mtu 1500",
+	"	port \"p4\"",
+	"}",
+	"after \"c\"",
+	NULL,
+};
+
+static const char *rejected[] = {
+	"switch \"s1\" {",
+	"	port \"p1\"",
+	"	port \"reject\"",
+	"}",
+	NULL,
+};
+
+#ifdef GCFG_DISABLE_ALLOC
+static const char *expected =
+	"after[a];after[b];s1;port[p1];port[p2];port[p3];mtu;port[p4];"
+	"close;after[c];";
+#else
+static const char *expected =
+	"after[a,b];s1;port[p1,p2,p3];mtu;port[p4];close;after[c];";
+#endif
+
+static int parse(const char **lines)
+{
+	line_file_t file;
+
+	line_file_init(&file, lines);
+	file.base.report_error = report_error;
+
+	trace[0] = '\0';
+
+	return gcfg_parse_file((gcfg_file_t *)&file, keywords, &top_level);
+}
+
+int main(void)
+{
+	if (parse(config) != 0 || strcmp(trace, expected) != 0) {
+		fprintf(stderr, "expected '%s', got '%s'\n", expected, trace);
+		return EXIT_FAILURE;
+	}
+
+	if (parse(rejected) == 0) {
+		fputs("rejected batch accepted\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * parse_deferred.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "gcfg.h"
+#include "test.h"
+
+typedef struct {
+	long port_sum;
+	int routes;
+	int closed;
+
+	gcfg_deferred_t bodies[4];
+	size_t count;
+} server_t;
+
+static void *cb_port(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	server_t *srv = parent;
+
+	(void)f;
+	srv->port_sum += (long)val->data.number[0].value;
+	return parent;
+}
+
+static void *cb_route(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	server_t *srv = parent;
+
+	(void)f; (void)val;
+	srv->routes += 1;
+	return parent;
+}
+
+static void *cb_server(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)val;
+	return parent;
+}
+
+static int cb_deferred(gcfg_file_t *f, void *child,
+		       const gcfg_deferred_t *body)
+{
+	server_t *srv = child;
+
+	(void)f;
+	if (srv->count >= sizeof(srv->bodies) / sizeof(srv->bodies[0]))
+		return -1;
+
+	srv->bodies[srv->count++] = *body;
+	return 0;
+}
+
+static int cb_close(gcfg_file_t *f, void *child)
+{
+	server_t *srv = child;
+
+	(void)f;
+	srv->closed += 1;
+	return 0;
+}
+
+GCFG_BEGIN_KEYWORDS(route_keywords)
+	GCFG_KEYWORD_NUMBER("port", NULL, cb_port, NULL),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(server_keywords)
+	GCFG_KEYWORD_NUMBER("port", NULL, cb_port, NULL),
+	GCFG_KEYWORD_STRING("route", route_keywords, cb_route, NULL),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(keywords)
+	GCFG_KEYWORD_DEFERRED_BASE("server", GCFG_VALUE_STRING, NULL,
+				   server_keywords, cb_server, cb_close,
+				   cb_deferred),
+	GCFG_KEYWORD_NUMBER("port", NULL, cb_port, NULL),
+GCFG_END_KEYWORDS();
+
+static const char *config =
+	"server \"a\" {\n"
+	"\tport 80\n"
+	"\troute \"/{x}\" {   # {\n"
+	"\t\tport 1\n"
+	"\t}\n"
+	"}\n"
+	"port 5\n"
+	"\n"
+	"server \"b\" {\n"
+	"\tbogus 1\n"
+	"}\n";
+
+static int check_body(const server_t *srv, size_t i, unsigned long line,
+		      unsigned long count)
+{
+	if (srv->bodies[i].line != line || srv->bodies[i].count != count ||
+	    srv->bodies[i].keyword != keywords) {
+		fprintf(stderr, "body %u: expected %lu+%lu, got %lu+%lu\n",
+			(unsigned int)i, line, count, srv->bodies[i].line,
+			srv->bodies[i].count);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the push parser has no line index, it parses deferred bodies right away */
+static int check_push(void)
+{
+	const char *split = strstr(config, "\troute");
+	const char *end = strstr(config, "\nserver \"b\"");
+	gcfg_parser_t *parser;
+	server_t srv;
+	int ret;
+
+	memset(&srv, 0, sizeof(srv));
+
+	parser = gcfg_parser_create("push", keywords, &srv,
+				    GCFG_DEFAULT_MAX_DEPTH);
+	if (parser == NULL)
+		return -1;
+
+	ret = gcfg_parser_feed(parser, config, (size_t)(split - config));
+	if (ret == 0)
+		ret = gcfg_parser_feed(parser, split, (size_t)(end - split));
+	if (ret == 0)
+		ret = gcfg_parser_finish(parser);
+
+	gcfg_parser_destroy(parser);
+
+	if (ret != 0) {
+		fputs("deferred body split across feeds failed\n", stderr);
+		return -1;
+	}
+
+	if (srv.count != 0 || srv.closed != 1 || srv.port_sum != 86 ||
+	    srv.routes != 1) {
+		fputs("push parser deferred a body\n", stderr);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	int ret = EXIT_FAILURE;
+	gcfg_file_t *file;
+	server_t srv;
+
+	memset(&srv, 0, sizeof(srv));
+
+	file = gcfg_file_open_memory("deferred.cfg", config, strlen(config));
+	if (file == NULL)
+		return EXIT_FAILURE;
+
+	/* only the braces of the bodies are checked */
+	if (gcfg_parse_file(file, keywords, &srv) != 0) {
+		fputs("parsing with deferred blocks failed\n", stderr);
+		goto out;
+	}
+
+	if (srv.count != 2 || srv.closed != 2 || srv.port_sum != 5 ||
+	    srv.routes != 0) {
+		fputs("deferred bodies were parsed\n", stderr);
+		goto out;
+	}
+
+	if (check_body(&srv, 0, 2, 5) || check_body(&srv, 1, 10, 2))
+		goto out;
+
+	if (gcfg_file_build_index(file))
+		goto out;
+
+	/* the bodies on demand, in any order */
+	if (gcfg_parse_deferred(file, srv.bodies + 1, &srv) == 0) {
+		fputs("broken deferred body accepted\n", stderr);
+		goto out;
+	}
+
+	if (gcfg_parse_deferred(file, srv.bodies, &srv) != 0) {
+		fputs("parsing a deferred body failed\n", stderr);
+		goto out;
+	}
+
+	if (srv.port_sum != 86 || srv.routes != 1 || srv.closed != 2) {
+		fprintf(stderr, "deferred body: got ports %ld, routes %d\n",
+			srv.port_sum, srv.routes);
+		goto out;
+	}
+
+	if (check_push())
+		goto out;
+
+	ret = EXIT_SUCCESS;
+out:
+	gcfg_file_close(file);
+	return ret;
+}
@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * parse_depth.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "test.h"
+
+static size_t opened, closed;
+
+static void *cb_block(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)val;
+	opened += 1;
+	return parent;
+}
+
+static void *cb_value(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)val;
+	return parent;
+}
+
+static int cb_close(gcfg_file_t *f, void *object)
+{
+	(void)f; (void)object;
+	closed += 1;
+	return 0;
+}
+
+/* forward declaration, blocks can be nested in themselves */
+static const gcfg_keyword_t keywords[3];
+
+GCFG_BEGIN_KEYWORDS(keywords)
+	GCFG_KEYWORD_NO_ARG("block", keywords, cb_block, cb_close),
+	GCFG_KEYWORD_NUMBER("value", NULL, cb_value, NULL),
+GCFG_END_KEYWORDS();
+
+/*
+  Opens depth blocks, at most 100, puts a value in the innermost one and
+  closes them.
+*/
+static int parse(size_t depth, gcfg_block_t *stack, size_t max_depth)
+{
+	const char *lines[2 * 100 + 2];
+	line_file_t file;
+	size_t i;
+
+	for (i = 0; i < depth; ++i) {
+		lines[i] = "block {";
+		lines[depth + 1 + i] = "}";
+	}
+
+	lines[depth] = "value 42";
+	lines[2 * depth + 1] = NULL;
+
+	line_file_init(&file, lines);
+
+	opened = 0;
+	closed = 0;
+
+	if (stack == NULL)
+		return gcfg_parse_file((gcfg_file_t *)&file, keywords, &file);
+
+	return gcfg_parse_file_depth((gcfg_file_t *)&file, keywords, &file,
+				     stack, max_depth);
+}
+
+int main(void)
+{
+	gcfg_block_t stack[100];
+
+	if (parse(GCFG_DEFAULT_MAX_DEPTH, NULL, 0) != 0 ||
+	    opened != GCFG_DEFAULT_MAX_DEPTH ||
+	    closed != GCFG_DEFAULT_MAX_DEPTH) {
+		fputs("parsing up to the default depth failed\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse(GCFG_DEFAULT_MAX_DEPTH + 1, NULL, 0) == 0) {
+		fputs("exceeding the default depth was accepted\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse(100, stack, 100) != 0 || opened != 100 || closed != 100) {
+		fputs("parsing with a larger stack failed\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse(4, stack, 3) == 0 || opened != 4 || closed != 0) {
+		fputs("exceeding a custom depth was accepted\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse(0, stack, 0) != 0) {
+		fputs("a flat file must work without a stack\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
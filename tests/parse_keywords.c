@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * parse_keywords.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "test.h"
+
+static int seen;
+
+#define KWD_CB(id) \
+	static void *cb_##id(gcfg_file_t *f, void *parent, \
+			     const gcfg_value_t *val) \
+	{ \
+		(void)f; (void)val; \
+		seen = id; \
+		return parent; \
+	}
+
+KWD_CB(1)
+KWD_CB(2)
+KWD_CB(3)
+KWD_CB(4)
+KWD_CB(5)
+KWD_CB(6)
+KWD_CB(7)
+KWD_CB(8)
+KWD_CB(9)
+
+GCFG_BEGIN_KEYWORDS(small_list)
+	GCFG_KEYWORD_NO_ARG("foobar", NULL, cb_1, NULL),
+	GCFG_KEYWORD_NO_ARG("foo", NULL, cb_2, NULL),
+	GCFG_KEYWORD_NO_ARG("foo", NULL, cb_3, NULL),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(large_list)
+	GCFG_KEYWORD_NO_ARG("alpha", NULL, cb_1, NULL),
+	GCFG_KEYWORD_NO_ARG("foobar", NULL, cb_2, NULL),
+	GCFG_KEYWORD_NO_ARG("foo", NULL, cb_3, NULL),
+	GCFG_KEYWORD_NO_ARG("bravo", NULL, cb_4, NULL),
+	GCFG_KEYWORD_NO_ARG("foo", NULL, cb_5, NULL),
+	GCFG_KEYWORD_NO_ARG("charlie", NULL, cb_6, NULL),
+	GCFG_KEYWORD_NO_ARG("delta", NULL, cb_7, NULL),
+	GCFG_KEYWORD_NO_ARG("echo", NULL, cb_8, NULL),
+	GCFG_KEYWORD_NUMBER("num", NULL, cb_9, NULL),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(space_list)
+	GCFG_KEYWORD_NO_ARG("alpha", NULL, cb_1, NULL),
+	GCFG_KEYWORD_NO_ARG("foo bar", NULL, cb_2, NULL),
+	GCFG_KEYWORD_NO_ARG("foo", NULL, cb_3, NULL),
+	GCFG_KEYWORD_NO_ARG("bravo", NULL, cb_4, NULL),
+	GCFG_KEYWORD_NO_ARG("charlie", NULL, cb_5, NULL),
+	GCFG_KEYWORD_NO_ARG("delta", NULL, cb_6, NULL),
+	GCFG_KEYWORD_NO_ARG("echo", NULL, cb_7, NULL),
+	GCFG_KEYWORD_NO_ARG("golf", NULL, cb_8, NULL),
+GCFG_END_KEYWORDS();
+
+static const struct {
+	const gcfg_keyword_t *list;
+	const char *line;
+	int result;
+} testvec[] = {
+	{ small_list, "foobar", 1 },
+	{ small_list, "foo", 2 },
+	{ small_list, "  foo  # comment", 2 },
+	{ small_list, "fo", -1 },
+	{ small_list, "foob", -1 },
+	{ large_list, "foobar", 2 },
+	{ large_list, "foo", 3 },
+	{ large_list, "foo\t", 3 },
+	{ large_list, "foo#", 3 },
+	{ large_list, "echo", 8 },
+	{ large_list, "num 42", 9 },
+	{ large_list, "num42", -1 },
+	{ large_list, "fo", -1 },
+	{ large_list, "foo{", -1 },
+	{ large_list, "zulu", -1 },
+	{ space_list, "foo bar", 2 },
+	{ space_list, "foo", 3 },
+	{ space_list, "golf", 8 },
+};
+
+int main(void)
+{
+	const char *lines[2];
+	line_file_t file;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < sizeof(testvec) / sizeof(testvec[0]); ++i) {
+		line_file_init(&file, lines);
+
+		lines[0] = testvec[i].line;
+		lines[1] = NULL;
+		seen = 0;
+
+		ret = gcfg_parse_file((gcfg_file_t *)&file, testvec[i].list,
+				      &file);
+
+		if (testvec[i].result < 0) {
+			if (ret == 0) {
+				fprintf(stderr, "'%s' should fail\n",
+					testvec[i].line);
+				return EXIT_FAILURE;
+			}
+		} else if (ret != 0 || seen != testvec[i].result) {
+			fprintf(stderr, "'%s': expected keyword %d, got %d\n",
+				testvec[i].line, testvec[i].result, seen);
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
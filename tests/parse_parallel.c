@@ -0,0 +1,304 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * parse_parallel.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "gcfg.h"
+#include "test.h"
+
+#include <unistd.h>
+
+#define NUM_BLOCKS (5000)
+
+static char path[] = "/tmp/gcfg_parallel_XXXXXX";
+
+typedef struct {
+	char *data;
+	size_t used;
+	size_t max;
+} trace_t;
+
+static unsigned long counter;
+
+static void record(trace_t *trace, const char *str)
+{
+	size_t len = strlen(str);
+
+	if (trace->used + len + 2 > trace->max) {
+		trace->max = (trace->used + len + 2) * 2;
+		trace->data = realloc(trace->data, trace->max);
+		if (trace->data == NULL) {
+			perror("trace");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	memcpy(trace->data + trace->used, str, len);
+	trace->used += len;
+	trace->data[trace->used++] = ';';
+	trace->data[trace->used] = '\0';
+}
+
+static void *cb_string(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f;
+	record(parent, val->data.string);
+	return parent;
+}
+
+static void *cb_number(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	char buffer[32];
+
+	(void)f;
+	sprintf(buffer, "%ld", (long)val->data.number[0].value);
+	record(parent, buffer);
+	return parent;
+}
+
+static void *cb_list(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)val;
+	record(parent, "list");
+	return parent;
+}
+
+/* the closing line is recorded as it is, including its indentation */
+static int cb_listing(gcfg_file_t *f, void *child, const char *line)
+{
+	const char *ptr = line;
+
+	(void)f;
+
+	while (*ptr == ' ' || *ptr == '\t')
+		++ptr;
+
+	if (*ptr == '}') {
+		record(child, line);
+		return 1;
+	}
+
+	record(child, ptr);
+	return 0;
+}
+
+static int cb_close(gcfg_file_t *f, void *child)
+{
+	(void)f;
+	record(child, "close");
+	return 0;
+}
+
+static void *cb_count(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)val;
+	__atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+	return parent;
+}
+
+static int cb_count_listing(gcfg_file_t *f, void *child, const char *line)
+{
+	(void)f; (void)child;
+
+	while (*line == ' ' || *line == '\t')
+		++line;
+
+	if (*line == '}')
+		return 1;
+
+	__atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static int cb_batch(gcfg_file_t *f, void *parent, const gcfg_value_t *values,
+		    size_t count)
+{
+	size_t i;
+
+	(void)f;
+	record(parent, "port[");
+
+	for (i = 0; i < count; ++i)
+		record(parent, values[i].data.string);
+
+	record(parent, "]");
+	return 0;
+}
+
+static int cb_count_batch(gcfg_file_t *f, void *parent,
+			  const gcfg_value_t *values, size_t count)
+{
+	(void)f; (void)parent; (void)values;
+	__atomic_fetch_add(&counter, count, __ATOMIC_RELAXED);
+	return 0;
+}
+
+GCFG_BEGIN_KEYWORDS(node_keywords)
+	GCFG_KEYWORD_NUMBER("mtu", NULL, cb_number, NULL),
+	GCFG_KEYWORD_BATCH_BASE("port", GCFG_VALUE_STRING, NULL, cb_batch),
+	GCFG_KEYWORD_STRING("name", NULL, cb_string, NULL),
+	{
+		.name = "list",
+		.arg = GCFG_VALUE_NONE,
+		.set_property = cb_list,
+		.finalize_object = cb_close,
+		.handle_listing = cb_listing,
+	},
+GCFG_END_KEYWORDS();
+
+static int cb_deferred(gcfg_file_t *f, void *child,
+		       const gcfg_deferred_t *body)
+{
+	char buffer[64];
+
+	(void)f;
+	sprintf(buffer, "lazy %lu+%lu", body->line, body->count);
+	record(child, buffer);
+	return 0;
+}
+
+GCFG_BEGIN_KEYWORDS(keywords)
+	GCFG_KEYWORD_STRING("node", node_keywords, cb_string, cb_close),
+	GCFG_KEYWORD_NUMBER("value", NULL, cb_number, NULL),
+	GCFG_KEYWORD_DEFERRED_BASE("lazy", GCFG_VALUE_NONE, NULL,
+				   node_keywords, cb_list, cb_close,
+				   cb_deferred),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(count_node_keywords)
+	GCFG_KEYWORD_NUMBER("mtu", NULL, cb_count, NULL),
+	GCFG_KEYWORD_BATCH_BASE("port", GCFG_VALUE_STRING, NULL,
+				cb_count_batch),
+	GCFG_KEYWORD_STRING("name", NULL, cb_count, NULL),
+	{
+		.name = "list",
+		.arg = GCFG_VALUE_NONE,
+		.set_property = cb_count,
+		.handle_listing = cb_count_listing,
+	},
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(count_keywords)
+	GCFG_KEYWORD_STRING("node", count_node_keywords, cb_count, NULL),
+	GCFG_KEYWORD_NUMBER("value", NULL, cb_count, NULL),
+	GCFG_KEYWORD_DEFERRED_BASE("lazy", GCFG_VALUE_NONE, NULL,
+				   count_node_keywords, cb_count, NULL, NULL),
+GCFG_END_KEYWORDS();
+
+/* blocks with braces in strings, comments and listings */
+static void write_config(const char *broken)
+{
+	FILE *fp = fopen(path, "w");
+	int i;
+
+	if (fp == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < NUM_BLOCKS; ++i) {
+		fprintf(fp, "node \"n%d {\" {   # }\n", i);
+		fprintf(fp, "\tmtu %d\n", i);
+		fprintf(fp, "\tname \"}\"\n");
+
+		if (i % 3 == 0)
+			fputs("\tport \"a\"\n\tport \"b\"\n\tport \"c\"\n", fp);
+
+		if (i % 7 == 0)
+			fputs("\tlist {\n\t\tfoo {\n\t\t\"}\n\t}\n", fp);
+
+		fputs("}\n\n# comment {\n", fp);
+
+		if (i % 5 == 0)
+			fprintf(fp, "value %d\n", i);
+
+		if (i % 11 == 0)
+			fputs("lazy {\n\tmtu 1\n\n\tname \"}\"\n}\n", fp);
+
+		if (broken != NULL && i == NUM_BLOCKS / 2)
+			fputs(broken, fp);
+	}
+
+	fclose(fp);
+}
+
+static int parse_sequential(trace_t *trace)
+{
+	gcfg_file_t *file;
+	int ret;
+
+	trace->used = 0;
+
+	file = gcfg_file_open(path);
+	if (file == NULL)
+		return -1;
+
+	ret = gcfg_parse_file(file, keywords, trace);
+	gcfg_file_close(file);
+	return ret;
+}
+
+static int compare(const char *broken)
+{
+	trace_t a, b;
+	int ret, ret_seq;
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	write_config(broken);
+
+	ret_seq = parse_sequential(&a);
+	ret = gcfg_parse_path_parallel(path, keywords, &b, 4, 0);
+
+	if (ret != ret_seq || a.used != b.used ||
+	    (a.used > 0 && strcmp(a.data, b.data) != 0)) {
+		fprintf(stderr, "parallel parse differs (%d vs %d)\n",
+			ret, ret_seq);
+		return -1;
+	}
+
+	free(a.data);
+	free(b.data);
+	return 0;
+}
+
+int main(void)
+{
+	int fd, ret = EXIT_FAILURE;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	if (compare(NULL) || compare("node \"x\" {\n\tbogus\n}\n") ||
+	    compare("}\n")) {
+		goto out;
+	}
+
+	/* callbacks from the workers, in any order */
+	write_config(NULL);
+
+	if (gcfg_parse_path_parallel(path, count_keywords, &counter, 4,
+				     GCFG_PARALLEL_UNORDERED) != 0) {
+		fputs("unordered parallel parse failed\n", stderr);
+		goto out;
+	}
+
+	/* node, mtu and name per block, list and two lines every 7th,
+	   three ports every 3rd, deferred bodies are skipped */
+	if (counter != NUM_BLOCKS * 3 + (NUM_BLOCKS / 7 + 1) * 3 +
+	    (NUM_BLOCKS / 3 + 1) * 3 + NUM_BLOCKS / 5 + NUM_BLOCKS / 11 + 1) {
+		fprintf(stderr, "unordered parse: got %lu callbacks\n",
+			counter);
+		goto out;
+	}
+
+	ret = EXIT_SUCCESS;
+out:
+	unlink(path);
+	return ret;
+}
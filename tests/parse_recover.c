@@ -0,0 +1,209 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * parse_recover.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "test.h"
+
+static long total_size;
+static int item_count;
+
+static void report_error(gcfg_file_t *f, const char *msg, ...)
+{
+	(void)f; (void)msg;
+	fputs("error passed to report_error\n", stderr);
+	exit(EXIT_FAILURE);
+}
+
+static void *cb_item(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f;
+
+	if (strcmp(val->data.string, "reject") == 0)
+		return NULL;
+
+	item_count += 1;
+	return parent;
+}
+
+static void *cb_size(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f;
+	total_size += (long)val->data.number[0].value;
+	return parent;
+}
+
+static void *cb_name(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)val;
+	return parent;
+}
+
+GCFG_BEGIN_KEYWORDS(item_keywords)
+	GCFG_KEYWORD_NUMBER("size", NULL, cb_size, NULL),
+	GCFG_KEYWORD_STRING("name", NULL, cb_name, NULL),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(keywords)
+	GCFG_KEYWORD_STRING("item", item_keywords, cb_item, NULL),
+GCFG_END_KEYWORDS();
+
+static const char *config[] = {
+	"item \"a\" {",
+	"	size 42",
+	"	bogus 1",
+	"	name \"foo\" extra",
+	"}",
+	"unknown \"x\" {",
+	"	size 1",
+	"	inner {",
+	"	}",
+	"}",
+	"item \"b\" {",
+	"	size abc",
+	"}",
+	"item \"c\" {",
+	"	size 7",
+	"}",
+	"}",
+	"item \"reject\" {",
+	"	size 1000",
+	"}",
+	"item \"d\" {",
+	"	size 1",
+	NULL,
+};
+
+static const gcfg_diagnostic_t expected[] = {
+	{ 3, 2, GCFG_DIAG_UNKNOWN_KEYWORD, "" },
+	{ 4, 13, GCFG_DIAG_SYNTAX, "" },
+	{ 6, 1, GCFG_DIAG_UNKNOWN_KEYWORD, "" },
+	{ 12, 7, GCFG_DIAG_ARGUMENT, "" },
+	{ 17, 1, GCFG_DIAG_NESTING, "" },
+	{ 18, 1, GCFG_DIAG_CALLBACK, "" },
+	{ 22, 0, GCFG_DIAG_NESTING, "" },
+};
+
+static const char *valid[] = {
+	"item \"a\" {",
+	"	size 1",
+	"}",
+	NULL,
+};
+
+#define NUM_EXPECTED (sizeof(expected) / sizeof(expected[0]))
+
+#define BATCH_SIZE (4)
+
+/* Hands out the lines of a line_file_t a few at a time */
+typedef struct {
+	line_file_t file;
+	gcfg_line_t lines[BATCH_SIZE];
+	char data[BATCH_SIZE][64];
+} batch_file_t;
+
+static int fetch_lines(gcfg_file_t *f)
+{
+	batch_file_t *file = (batch_file_t *)f;
+	const char *line;
+	size_t count = 0;
+
+	while (count < BATCH_SIZE) {
+		line = file->file.lines[file->file.index];
+		if (line == NULL)
+			break;
+
+		file->file.index += 1;
+
+		strcpy(file->data[count], line);
+		file->lines[count].data = file->data[count];
+		file->lines[count].length = strlen(line);
+		file->lines[count].flags = 0;
+		++count;
+	}
+
+	f->lines = file->lines;
+	f->line_count = count;
+	f->line_index = 0;
+	return count > 0 ? 0 : 1;
+}
+
+static int parse(const char **lines, gcfg_diagnostic_t *diag, size_t max,
+		 size_t *count, bool batch)
+{
+	batch_file_t file;
+
+	line_file_init(&file.file, lines);
+	file.file.base.report_error = report_error;
+
+	if (batch)
+		file.file.base.fetch_lines = fetch_lines;
+
+	total_size = 0;
+	item_count = 0;
+
+	return gcfg_parse_file_recover((gcfg_file_t *)&file, keywords,
+				       &item_count, diag, max, count);
+}
+
+static void check(bool batch)
+{
+	gcfg_diagnostic_t diag[NUM_EXPECTED + 4];
+	size_t i, count;
+
+	/* collect all errors */
+	if (parse(config, diag, NUM_EXPECTED + 4, &count, batch) == 0) {
+		fputs("broken file accepted\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	if (count != NUM_EXPECTED) {
+		fprintf(stderr, "expected %u errors, got %u\n",
+			(unsigned int)NUM_EXPECTED, (unsigned int)count);
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (diag[i].line != expected[i].line ||
+		    diag[i].column != expected[i].column ||
+		    diag[i].code != expected[i].code ||
+		    diag[i].message[0] == '\0') {
+			fprintf(stderr, "error %u: expected %lu:%lu (%d), "
+				"got %lu:%lu (%d) '%s'\n", (unsigned int)i,
+				expected[i].line, expected[i].column,
+				expected[i].code, diag[i].line,
+				diag[i].column, diag[i].code,
+				diag[i].message);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* skipped blocks must not reach the callbacks */
+	if (item_count != 4 || total_size != 50) {
+		fprintf(stderr, "expected 4 items of size 50, got %d of %ld\n",
+			item_count, total_size);
+		exit(EXIT_FAILURE);
+	}
+
+	/* stop after the first errors */
+	if (parse(config, diag, 2, &count, batch) == 0 || count != 2 ||
+	    total_size != 42) {
+		fputs("parsing did not stop at the maximum\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	/* no errors */
+	if (parse(valid, diag, NUM_EXPECTED, &count, batch) != 0 ||
+	    count != 0 || item_count != 1 || total_size != 1) {
+		fputs("parsing a valid file failed\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+}
+
+int main(void)
+{
+	check(false);
+	check(true);
+	return EXIT_SUCCESS;
+}
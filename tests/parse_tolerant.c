@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * parse_tolerant.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "test.h"
+
+static int errors;
+static long total_size;
+
+static void report_error(gcfg_file_t *f, const char *msg, ...)
+{
+	(void)f; (void)msg;
+	errors += 1;
+}
+
+static void *cb_size(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f;
+	total_size += (long)val->data.number[0].value;
+	return parent;
+}
+
+static void *cb_item(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)val;
+	return parent;
+}
+
+GCFG_BEGIN_KEYWORDS(item_keywords)
+	GCFG_KEYWORD_NUMBER("size", NULL, cb_size, NULL),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(keywords)
+	GCFG_KEYWORD_STRING("item", item_keywords, cb_item, NULL),
+	GCFG_KEYWORD_NUMBER("size", NULL, cb_size, NULL),
+GCFG_END_KEYWORDS();
+
+/* unknown keywords, their arguments and blocks are never looked at */
+static const char *config[] = {
+	"item \"a\" {",
+	"	size 1",
+	"	color red green \"}\"",
+	"	future \"x{\" {   # }",
+	"		size 1000",
+	"		nested {",
+	"			!!! \"}\" ###",
+	"		}",
+	"	}",
+	"	size 2",
+	"}",
+	"newthing {",
+	"	size 1000",
+	"}",
+	"size 4",
+	NULL,
+};
+
+static const char *unbalanced[] = {
+	"size 1",
+	"newthing {",
+	"	inner {",
+	"	}",
+	NULL,
+};
+
+/* the encoding of a skipped block is not checked either */
+static const char *binary[] = {
+	"newthing {",
+	"	blob \"\xFF\xFE\x80\"",
+	"	\xC0\xAF {",
+	"	}",
+	"}",
+	"size 4",
+	NULL,
+};
+
+static const char *binary_known[] = {
+	"item \"a\" {",
+	"	size 1 # \xFF\xFE",
+	"}",
+	NULL,
+};
+
+static int parse(const char **lines, uint32_t flags)
+{
+	line_file_t file;
+
+	line_file_init(&file, lines);
+	file.base.report_error = report_error;
+
+	errors = 0;
+	total_size = 0;
+
+	return gcfg_parse_file_flags((gcfg_file_t *)&file, keywords, &errors,
+				     flags);
+}
+
+int main(void)
+{
+	if (parse(config, GCFG_PARSE_TOLERANT) != 0 || errors != 0 ||
+	    total_size != 7) {
+		fprintf(stderr, "tolerant parse: %d errors, size %ld\n",
+			errors, total_size);
+		return EXIT_FAILURE;
+	}
+
+	/* without the flag, the same input is rejected */
+	if (parse(config, 0) == 0 || errors != 1) {
+		fputs("unknown keyword accepted\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	/* skipped blocks must still be closed */
+	if (parse(unbalanced, GCFG_PARSE_TOLERANT) == 0 || errors != 1) {
+		fputs("unterminated unknown block accepted\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (parse(binary, GCFG_PARSE_TOLERANT) != 0 || errors != 0 ||
+	    total_size != 4) {
+		fprintf(stderr, "skipping invalid UTF-8: %d errors, size %ld\n",
+			errors, total_size);
+		return EXIT_FAILURE;
+	}
+
+	/* everywhere else, it still is */
+	if (parse(binary_known, GCFG_PARSE_TOLERANT) == 0 || errors != 1) {
+		fputs("invalid UTF-8 accepted\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
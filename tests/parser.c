@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * parser.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "test.h"
+
+static char trace[512];
+
+static void record(const char *str)
+{
+	strcat(trace, str);
+	strcat(trace, ";");
+}
+
+static void *cb_item(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f;
+	record(val->data.string);
+	return parent;
+}
+
+static void *cb_size(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f;
+	record(val->data.number[0].value == 42 ? "42" : "?");
+	return parent;
+}
+
+static void *cb_files(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)val;
+	record("files");
+	return parent;
+}
+
+static int cb_listing(gcfg_file_t *f, void *child, const char *line)
+{
+	(void)f; (void)child;
+
+	while (*line == ' ' || *line == '\t')
+		++line;
+
+	if (*line == '}')
+		return 1;
+
+	record(line);
+	return 0;
+}
+
+static int cb_close(gcfg_file_t *f, void *object)
+{
+	(void)f; (void)object;
+	record("close");
+	return 0;
+}
+
+GCFG_BEGIN_KEYWORDS(item_keywords)
+	GCFG_KEYWORD_NUMBER("size", NULL, cb_size, NULL),
+	GCFG_KEYWORD_STRING("name", NULL, cb_item, NULL),
+GCFG_END_KEYWORDS();
+
+static const gcfg_keyword_t keywords[] = {
+	GCFG_KEYWORD_STRING("item", item_keywords, cb_item, cb_close),
+	{
+		.name = "files",
+		.arg = GCFG_VALUE_NONE,
+		.set_property = cb_files,
+		.finalize_object = cb_close,
+		.handle_listing = cb_listing,
+	},
+	{ .name = NULL },
+};
+
+static const char *config =
+	"# a comment\n"
+	"item \"first\" {\r\n"
+	"\tsize 42\n"
+	"\tname \"a long string value\"\n"
+	"}\n"
+	"\n"
+	"files {\n"
+	"\t/bin/sh\n"
+	"}\n"
+	"item \"last\" {\n"
+	"}";
+
+static const char *expected =
+	"first;42;a long string value;close;files;/bin/sh;close;last;close;";
+
+static int feed(const char *data, size_t chunk, bool finish)
+{
+	gcfg_parser_t *parser;
+	size_t size, total = strlen(data);
+	int ret = 0;
+
+	trace[0] = '\0';
+
+	parser = gcfg_parser_create("test", keywords, trace,
+				    GCFG_DEFAULT_MAX_DEPTH);
+	if (parser == NULL)
+		return -1;
+
+	while (total > 0 && ret == 0) {
+		size = total < chunk ? total : chunk;
+		ret = gcfg_parser_feed(parser, data, size);
+		data += size;
+		total -= size;
+	}
+
+	if (ret == 0 && finish)
+		ret = gcfg_parser_finish(parser);
+
+	gcfg_parser_destroy(parser);
+	return ret;
+}
+
+int main(void)
+{
+	size_t chunk;
+
+	for (chunk = 1; chunk <= strlen(config); ++chunk) {
+		if (feed(config, chunk, true) != 0) {
+			fprintf(stderr, "feeding %u byte chunks failed\n",
+				(unsigned int)chunk);
+			return EXIT_FAILURE;
+		}
+
+		if (strcmp(trace, expected) != 0) {
+			fprintf(stderr, "%u byte chunks: expected %s, got %s\n",
+				(unsigned int)chunk, expected, trace);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* the last line is only processed at the end of the input */
+	if (feed(config, 7, false) != 0 ||
+	    strcmp(trace, "first;42;a long string value;close;files;"
+		   "/bin/sh;close;last;") != 0) {
+		fputs("unterminated last line was processed early\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (feed("item \"x\" {\n", 4, true) == 0) {
+		fputs("unclosed block accepted at end of input\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (feed("}\n", 1, false) == 0) {
+		fputs("unbalanced '}' accepted\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
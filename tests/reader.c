@@ -0,0 +1,179 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * reader.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "test.h"
+
+/* never called, the reader hands out events instead */
+static void *cb_fail(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)parent; (void)val;
+	fputs("reader called a keyword callback\n", stderr);
+	exit(EXIT_FAILURE);
+}
+
+static int cb_listing(gcfg_file_t *f, void *child, const char *line)
+{
+	(void)f; (void)child; (void)line;
+	fputs("reader called a listing callback\n", stderr);
+	exit(EXIT_FAILURE);
+}
+
+GCFG_BEGIN_KEYWORDS(item_keywords)
+	GCFG_KEYWORD_NUMBER("size", NULL, cb_fail, NULL),
+	GCFG_KEYWORD_STRING("name", NULL, cb_fail, NULL),
+GCFG_END_KEYWORDS();
+
+static const gcfg_keyword_t keywords[] = {
+	GCFG_KEYWORD_STRING("item", item_keywords, cb_fail, NULL),
+	{
+		.name = "files",
+		.arg = GCFG_VALUE_NONE,
+		.set_property = cb_fail,
+		.handle_listing = cb_listing,
+	},
+	GCFG_KEYWORD_BOOL("enable", NULL, cb_fail, NULL),
+	{ .name = NULL },
+};
+
+static const char *config[] = {
+	"# a comment",
+	"item \"first\" {",
+	"	size 42",
+	"	name \"foo\"",
+	"}",
+	"",
+	"files {",
+	"	/bin/sh",
+	"	  }",
+	"enable yes",
+	NULL,
+};
+
+typedef struct {
+	int type;
+	const char *keyword;
+	const char *string;
+} expected_t;
+
+static const expected_t expected[] = {
+	{ GCFG_EVENT_BEGIN_BLOCK, "item", "first" },
+	{ GCFG_EVENT_VALUE, "size", NULL },
+	{ GCFG_EVENT_VALUE, "name", "foo" },
+	{ GCFG_EVENT_END_BLOCK, "item", NULL },
+	{ GCFG_EVENT_BEGIN_BLOCK, "files", NULL },
+	{ GCFG_EVENT_LISTING_LINE, "files", "\t/bin/sh" },
+	{ GCFG_EVENT_END_BLOCK, "files", NULL },
+	{ GCFG_EVENT_VALUE, "enable", NULL },
+};
+
+static const char *truncated[] = {
+	"item \"first\" {",
+	"	size 42",
+	NULL,
+};
+
+int main(void)
+{
+	const expected_t *exp;
+	line_file_t file;
+	gcfg_reader_t *rd;
+	gcfg_event_t ev;
+	const char *str;
+	size_t i;
+	int ret;
+
+	/* read all events */
+	line_file_init(&file, config);
+
+	rd = gcfg_reader_create((gcfg_file_t *)&file, keywords,
+				GCFG_DEFAULT_MAX_DEPTH);
+	if (rd == NULL) {
+		fputs("creating a reader failed\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+		exp = expected + i;
+
+		if (gcfg_reader_next(rd, &ev) != 0) {
+			fprintf(stderr, "event %u: failed\n", (unsigned int)i);
+			return EXIT_FAILURE;
+		}
+
+		if (ev.type != exp->type ||
+		    strcmp(ev.keyword->name, exp->keyword) != 0) {
+			fprintf(stderr, "event %u: expected %d %s, got %d %s\n",
+				(unsigned int)i, exp->type, exp->keyword,
+				ev.type, ev.keyword->name);
+			return EXIT_FAILURE;
+		}
+
+		if (exp->string == NULL)
+			continue;
+
+		str = ev.type == GCFG_EVENT_LISTING_LINE ?
+			ev.line : ev.value.data.string;
+
+		if (strcmp(str, exp->string) != 0) {
+			fprintf(stderr, "event %u: expected '%s', got '%s'\n",
+				(unsigned int)i, exp->string, str);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (ev.linenum != 10) {
+		fprintf(stderr, "last event: expected line 10, got %lu\n",
+			ev.linenum);
+		return EXIT_FAILURE;
+	}
+
+	if (gcfg_reader_next(rd, &ev) <= 0) {
+		fputs("expected end of file after last event\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	gcfg_reader_destroy(rd);
+
+	/* stop early, without reading the rest of the file */
+	line_file_init(&file, config);
+
+	rd = gcfg_reader_create((gcfg_file_t *)&file, keywords,
+				GCFG_DEFAULT_MAX_DEPTH);
+	if (rd == NULL) {
+		fputs("creating a reader failed\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	ret = gcfg_reader_next(rd, &ev);
+	gcfg_reader_destroy(rd);
+
+	if (ret != 0 || ev.type != GCFG_EVENT_BEGIN_BLOCK || file.index != 2) {
+		fputs("stopping after the first event failed\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	/* unterminated block */
+	line_file_init(&file, truncated);
+
+	rd = gcfg_reader_create((gcfg_file_t *)&file, keywords,
+				GCFG_DEFAULT_MAX_DEPTH);
+	if (rd == NULL) {
+		fputs("creating a reader failed\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	while ((ret = gcfg_reader_next(rd, &ev)) == 0)
+		;
+
+	gcfg_reader_destroy(rd);
+
+	if (ret > 0) {
+		fputs("missing '}' at the end was accepted\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * scan_block.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "internal.h"
+#include "test.h"
+
+#include <inttypes.h>
+
+#define ROUNDS (20000)
+
+typedef void (*scan_fun_t)(const char *data, gcfg_block_bits_t *out);
+
+static const struct {
+	const char *name;
+	scan_fun_t scan;
+} variants[] = {
+	{ "generic", gcfg_scan_block },
+	{ "swar", gcfg_scan_block_swar },
+#ifdef GCFG_HAVE_X86_SIMD
+	{ "sse2", gcfg_scan_block_sse2 },
+	{ "avx2", gcfg_scan_block_avx2 },
+#endif
+};
+
+/* bytes at the edges of the classes, drawn more often than others */
+static const unsigned char edges[] = {
+	'\n', '\r', '\t', 0x00, 0x1F, 0x20, 0x7E, 0x7F, 0x80, 0xFF,
+};
+
+static uint32_t state = 0x2545F491;
+
+static uint32_t next_random(void)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static void scan_reference(const char *data, gcfg_block_bits_t *out)
+{
+	size_t i;
+	int c;
+
+	memset(out, 0, sizeof(*out));
+
+	for (i = 0; i < 64; ++i) {
+		c = ((const unsigned char *)data)[i];
+
+		if (c == '\n') {
+			out->newline |= (uint64_t)1 << i;
+		} else if (c == '\r') {
+			out->cr |= (uint64_t)1 << i;
+		} else if (c != '\t' && (c < 0x20 || c >= 0x7F)) {
+			out->other |= (uint64_t)1 << i;
+		}
+	}
+}
+
+static bool is_supported(size_t i)
+{
+#ifdef GCFG_HAVE_X86_SIMD
+	if (strcmp(variants[i].name, "sse2") == 0)
+		return __builtin_cpu_supports("sse2");
+
+	if (strcmp(variants[i].name, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+#else
+	(void)i;
+#endif
+	return true;
+}
+
+static int check_block(const char *data, size_t round)
+{
+	gcfg_block_bits_t expect, got;
+	size_t i;
+
+	scan_reference(data, &expect);
+
+	for (i = 0; i < sizeof(variants) / sizeof(variants[0]); ++i) {
+		if (!is_supported(i))
+			continue;
+
+		memset(&got, 0xA5, sizeof(got));
+		variants[i].scan(data, &got);
+
+		if (memcmp(&got, &expect, sizeof(got)) != 0) {
+			fprintf(stderr, "%s, round %u: expected %016" PRIx64
+				" %016" PRIx64 " %016" PRIx64 ", got %016"
+				PRIx64 " %016" PRIx64 " %016" PRIx64 "\n",
+				variants[i].name, (unsigned int)round,
+				expect.newline, expect.cr, expect.other,
+				got.newline, got.cr, got.other);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* a "\r\n" split across two blocks is classified one half each */
+static int check_split_crlf(void)
+{
+	char data[128];
+	size_t i;
+
+	memset(data, 'a', sizeof(data));
+	data[63] = '\r';
+	data[64] = '\n';
+	data[62] = 0x7F;
+	data[65] = (char)0x80;
+
+	for (i = 0; i < sizeof(data); i += 64) {
+		if (check_block(data + i, i))
+			return -1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	char data[64 + 7];
+	size_t i, j, off;
+	uint32_t r;
+
+	if (check_split_crlf())
+		return EXIT_FAILURE;
+
+	for (i = 0; i < ROUNDS; ++i) {
+		/* the loads must not depend on the alignment of the block */
+		off = i % 8;
+
+		for (j = 0; j < 64; ++j) {
+			r = next_random();
+
+			if ((r & 3) == 0) {
+				data[off + j] = (char)edges[(r >> 8) %
+							    sizeof(edges)];
+			} else {
+				data[off + j] = (char)(r >> 8);
+			}
+		}
+
+		if (check_block(data + off, i))
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
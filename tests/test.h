@@ -21,6 +21,17 @@ void dummy_file_init(gcfg_file_t *f, const char *line);
 
 void dummy_file_cleanup(gcfg_file_t *f);
 
+/* A file that hands out the lines of a NULL terminated array */
+typedef struct {
+	gcfg_file_t base;
+	const char **lines;
+	size_t index;
+	char buffer[64];
+} line_file_t;
+
+/* Errors are ignored, unless base.report_error is replaced afterwards. */
+void line_file_init(line_file_t *file, const char **lines);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * tracker.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "gcfg.h"
+#include "test.h"
+
+#include <unistd.h>
+
+static char path[] = "/tmp/gcfg_tracker_XXXXXX";
+static char trace[1024];
+
+static void record(const char *prefix, const char *str)
+{
+	size_t len = strlen(trace);
+
+	snprintf(trace + len, sizeof(trace) - len, "%s%s;", prefix, str);
+}
+
+static int cb_change(void *usr, int type, const char *line)
+{
+	(void)usr;
+
+	switch (type) {
+	case GCFG_CHANGE_ADDED:   record("+", line); break;
+	case GCFG_CHANGE_REMOVED: record("-", line); break;
+	case GCFG_CHANGE_CHANGED: record("*", line); break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+static void *cb_string(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f;
+	record("", val->data.string);
+	return parent;
+}
+
+static void *cb_number(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	char buffer[32];
+
+	(void)f;
+	sprintf(buffer, "%ld", (long)val->data.number[0].value);
+	record("", buffer);
+	return parent;
+}
+
+GCFG_BEGIN_KEYWORDS(node_keywords)
+	GCFG_KEYWORD_NUMBER("mtu", NULL, cb_number, NULL),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(keywords)
+	GCFG_KEYWORD_STRING("node", node_keywords, cb_string, NULL),
+	GCFG_KEYWORD_STRING("hostname", NULL, cb_string, NULL),
+GCFG_END_KEYWORDS();
+
+static const struct {
+	const char *config;
+	int ret;
+	const char *trace;
+} steps[] = {
+	{
+		"# nodes\n"
+		"node \"a\" {\n\tmtu 1500\n}\n\n"
+		"node \"b\" {\n\tmtu 1500\n}\n"
+		"hostname \"x\"\n",
+		0,
+		"+node \"a\" {;a;1500;+node \"b\" {;b;1500;"
+		"+hostname \"x\";x;",
+	}, {
+		"node \"a\" {\n\tmtu 1500\n}\n\n"
+		"node \"b\" {\n\tmtu 9000\n}\n"
+		"node \"c\" {\n\tmtu 1500\n}\n"
+		"hostname \"y\"\n",
+		0,
+		"-hostname \"x\";*node \"b\" {;b;9000;+node \"c\" {;c;1500;"
+		"+hostname \"y\";y;",
+	}, {
+		"node \"b\" {\n\tmtu 9000\n}\n"
+		"node \"c\" {   \n\tmtu 1500\n}\n"
+		"hostname \"y\"\n",
+		0,
+		"-node \"a\" {;*node \"c\" {;c;1500;",
+	}, {
+		/* fails after the callbacks for "c" ran, before "b" */
+		"node \"c\" {\n\tbogus 1500\n}\n"
+		"node \"b\" {\n\tmtu 1\n}\n"
+		"hostname \"z\"\n",
+		-1,
+		"-hostname \"y\";*node \"c\" {;c;",
+	}, {
+		/* "b" was never delivered, "c" was only delivered in part */
+		"node \"b\" {\n\tmtu 9000\n}\n"
+		"node \"c\" {   \n\tmtu 1500\n}\n"
+		"hostname \"z\"\n",
+		0,
+		"*node \"c\" {;c;1500;+hostname \"z\";z;",
+	}, {
+		"node \"b\" {\n\tmtu 9000\n}\n",
+		0,
+		"-node \"c\" {;-hostname \"z\";",
+	},
+};
+
+static void write_config(const char *data)
+{
+	FILE *fp = fopen(path, "w");
+
+	if (fp == NULL || fputs(data, fp) == EOF) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	fclose(fp);
+}
+
+int main(void)
+{
+	int fd, ret, status = EXIT_FAILURE;
+	gcfg_tracker_t *tracker;
+	size_t i;
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	tracker = gcfg_tracker_create(keywords, cb_change);
+	if (tracker == NULL) {
+		fputs("creating a tracker failed\n", stderr);
+		goto out;
+	}
+
+	for (i = 0; i < sizeof(steps) / sizeof(steps[0]); ++i) {
+		write_config(steps[i].config);
+		trace[0] = '\0';
+
+		ret = gcfg_tracker_update(tracker, path, trace);
+
+		if (ret != steps[i].ret || strcmp(trace, steps[i].trace) != 0) {
+			fprintf(stderr, "update %u: expected %d '%s', "
+				"got %d '%s'\n", (unsigned int)i,
+				steps[i].ret, steps[i].trace, ret, trace);
+			goto out;
+		}
+	}
+
+	status = EXIT_SUCCESS;
+out:
+	if (tracker != NULL)
+		gcfg_tracker_destroy(tracker);
+	unlink(path);
+	return status;
+}
@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * validate.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "test.h"
+
+static int errors;
+
+static void report_error(gcfg_file_t *f, const char *msg, ...)
+{
+	(void)f; (void)msg;
+	errors += 1;
+}
+
+/* only marks the keyword as having a listing, it is never called */
+static int cb_listing(gcfg_file_t *f, void *child, const char *line)
+{
+	(void)f; (void)child; (void)line;
+	fputs("listing callback called\n", stderr);
+	exit(EXIT_FAILURE);
+}
+
+/* the other callbacks are never called either, so they can be left out */
+GCFG_BEGIN_KEYWORDS(item_keywords)
+	GCFG_KEYWORD_SIZE("size", NULL, NULL, NULL),
+	GCFG_KEYWORD_BOOL("enabled", NULL, NULL, NULL),
+	{
+		.name = "notes",
+		.arg = GCFG_VALUE_NONE,
+		.handle_listing = cb_listing,
+	},
+GCFG_END_KEYWORDS();
+
+/* large enough to be looked up through an index */
+GCFG_BEGIN_KEYWORDS(color_keywords)
+	GCFG_KEYWORD_NO_ARG("red", NULL, NULL, NULL),
+	GCFG_KEYWORD_NO_ARG("green", NULL, NULL, NULL),
+	GCFG_KEYWORD_NO_ARG("blue", NULL, NULL, NULL),
+	GCFG_KEYWORD_NO_ARG("cyan", NULL, NULL, NULL),
+	GCFG_KEYWORD_NO_ARG("magenta", NULL, NULL, NULL),
+	GCFG_KEYWORD_NO_ARG("yellow", NULL, NULL, NULL),
+	GCFG_KEYWORD_NO_ARG("black", NULL, NULL, NULL),
+	GCFG_KEYWORD_NO_ARG("white", NULL, NULL, NULL),
+	GCFG_KEYWORD_SIZE("size", NULL, NULL, NULL),
+GCFG_END_KEYWORDS();
+
+GCFG_BEGIN_KEYWORDS(keywords)
+	GCFG_KEYWORD_STRING("item", item_keywords, NULL, NULL),
+	GCFG_KEYWORD_NO_ARG("colors", color_keywords, NULL, NULL),
+GCFG_END_KEYWORDS();
+
+static const char *valid[] = {
+	"item \"a\" {",
+	"	size 4k",
+	"	enabled yes",
+	"	notes {",
+	"		anything { goes",
+	"	}",
+	"}",
+	"colors {",
+	"	white",
+	"	size 1M",
+	"	red",
+	"}",
+	NULL,
+};
+
+static const char *bad_color[] = {
+	"colors {",
+	"	blue",
+	"	orange",
+	"}",
+	NULL,
+};
+
+static const char *bad_arg[] = {
+	"item \"a\" {",
+	"	size 4x",
+	"}",
+	NULL,
+};
+
+static const char *bad_keyword[] = {
+	"item \"a\" {",
+	"	color red",
+	"}",
+	NULL,
+};
+
+static const char *bad_nesting[] = {
+	"item \"a\" {",
+	"	enabled no",
+	NULL,
+};
+
+static int validate(const char **lines)
+{
+	line_file_t file;
+
+	line_file_init(&file, lines);
+	file.base.report_error = report_error;
+
+	errors = 0;
+	return gcfg_validate_file((gcfg_file_t *)&file, keywords);
+}
+
+int main(void)
+{
+	if (validate(valid) != 0 || errors != 0) {
+		fputs("valid file rejected\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (validate(bad_arg) == 0 || errors != 1 ||
+	    validate(bad_keyword) == 0 || errors != 1 ||
+	    validate(bad_nesting) == 0 || errors != 1 ||
+	    validate(bad_color) == 0 || errors != 1) {
+		fputs("invalid file accepted\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: ISC */
+/*
+ * watch.c
+ *
+ * Copyright (C) 2020 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "gcfg.h"
+#include "test.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char dir[] = "/tmp/gcfg_watch_XXXXXX";
+static char main_cfg[128];
+static char conf_d[128];
+
+static int reloads;
+static int values;
+
+static void *cb_value(gcfg_file_t *f, void *parent, const gcfg_value_t *val)
+{
+	(void)f; (void)val;
+	values += 1;
+	return parent;
+}
+
+GCFG_BEGIN_KEYWORDS(keywords)
+	GCFG_KEYWORD_NUMBER("value", NULL, cb_value, NULL),
+GCFG_END_KEYWORDS();
+
+static int cb_reload(void *usr, const char *path, gcfg_include_cache_t *cache)
+{
+	reloads += 1;
+	values = 0;
+	return gcfg_parse_path(path, keywords, usr, cache);
+}
+
+/* replaces a file through a rename, like most editors do */
+static void write_file(const char *name, const char *data)
+{
+	char path[256], tmp[256];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	snprintf(tmp, sizeof(tmp), "%s/.%s.tmp", dir, "new");
+
+	fp = fopen(tmp, "w");
+	if (fp == NULL || fputs(data, fp) == EOF) {
+		perror(tmp);
+		exit(EXIT_FAILURE);
+	}
+	fclose(fp);
+
+	if (rename(tmp, path) != 0) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static int expect(gcfg_watch_t *w, int ret, int count, int num_values)
+{
+	int got = gcfg_watch_dispatch(w, 1000);
+
+	if (got != ret || reloads != count || values != num_values) {
+		fprintf(stderr, "expected %d (%d reloads, %d values), "
+			"got %d (%d reloads, %d values)\n", ret, count,
+			num_values, got, reloads, values);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int run(void)
+{
+	gcfg_watch_t *w;
+	int ret = -1;
+
+	write_file("main.cfg", "value 1\ninclude \"conf.d/*.conf\"\n");
+
+	w = gcfg_watch_create(main_cfg, 50, cb_reload, &values);
+	if (w == NULL || reloads != 1 || values != 1) {
+		fputs("initial load failed\n", stderr);
+		goto out;
+	}
+
+	/* a new file matching the include pattern */
+	write_file("conf.d/a.conf", "value 2\n");
+	if (expect(w, 1, 2, 2))
+		goto out;
+
+	/* a burst of writes leads to a single reload */
+	write_file("conf.d/a.conf", "value 2\nvalue 3\n");
+	write_file("main.cfg", "value 1\n\ninclude \"conf.d/*.conf\"\n");
+	write_file("conf.d/a.conf", "value 2\nvalue 3\nvalue 4\n");
+	if (expect(w, 1, 3, 4))
+		goto out;
+
+	/* unrelated files are ignored */
+	write_file("conf.d/a.txt", "value 5\n");
+	write_file("other.cfg", "value 5\n");
+	if (expect(w, 0, 3, 4))
+		goto out;
+
+	/* a broken configuration is reported, and still watched */
+	write_file("main.cfg", "value\n");
+	if (expect(w, -1, 4, 0))
+		goto out;
+
+	write_file("main.cfg", "value 1\n");
+	if (expect(w, 1, 5, 1))
+		goto out;
+
+	ret = 0;
+out:
+	if (w != NULL)
+		gcfg_watch_destroy(w);
+	return ret;
+}
+
+int main(void)
+{
+	char path[256];
+	int ret;
+
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return EXIT_FAILURE;
+	}
+
+	snprintf(main_cfg, sizeof(main_cfg), "%s/main.cfg", dir);
+	snprintf(conf_d, sizeof(conf_d), "%s/conf.d", dir);
+
+	if (mkdir(conf_d, 0755) != 0) {
+		perror(conf_d);
+		rmdir(dir);
+		return EXIT_FAILURE;
+	}
+
+	ret = run();
+
+	snprintf(path, sizeof(path), "%s/a.conf", conf_d);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/a.txt", conf_d);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/other.cfg", dir);
+	unlink(path);
+	unlink(main_cfg);
+	rmdir(conf_d);
+	rmdir(dir);
+	return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}